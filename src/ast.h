@@ -8,11 +8,13 @@
 #include <map>
 #include <stack>
 #include <string>
+#include <sstream>
 
 #include "symbol.h"
 #include "type.h"
 
 static int result_id = 0;
+static int zero_fill_id = 0;
 static std::stack<int> stack_while_id;
 
 typedef struct{
@@ -63,6 +65,7 @@ typedef struct{
     int level;  /* zeroinit is available only when level = -1 */
     const_exps_result_t shape;
     bool is_global;
+    std::vector<int> zero_idx;  /* local arrays: elements left to `gen_local_array_zeros` */
 } const_init_val_param_t;
 
 typedef struct{
@@ -98,6 +101,7 @@ typedef struct{
     int level;
     const_exps_result_t shape;
     bool is_global;
+    std::vector<int> zero_idx;  /* local arrays: elements left to `gen_local_array_zeros` */
 } init_val_param_t;
 
 typedef struct{
@@ -128,6 +132,54 @@ static std::string gen_getelemptr_const_exp_koopa_code(
     return pointer_lhs;
 }
 
+/*
+    The zeros of a local array initializer. A few are stored one by one;
+    when there are many and they make up at least half of the array, a
+    loop clears the whole array instead, before the other stores.
+*/
+static const int ZERO_FILL_MIN_ELEMS = 32;
+
+static void gen_local_array_zeros(const std::string &pointer_array,
+        const std::vector<int> &zero_idx, const_exps_result_t &shape){
+    int size_tot = 1;
+    for(int i = 0; i < shape.dim; ++i){
+        size_tot *= shape.array_size[i];
+    }
+
+    if((int)zero_idx.size() < ZERO_FILL_MIN_ELEMS || 2 * (int)zero_idx.size() < size_tot){
+        for(int idx : zero_idx){
+            std::string result_pointer = gen_getelemptr_const_exp_koopa_code(pointer_array, idx, shape);
+            std::cout << "\tstore 0, " << result_pointer << std::endl;
+        }
+        return;
+    }
+
+    int id = zero_fill_id++;
+    std::string counter = "%zero_fill_i_" + std::to_string(id);
+    std::cout << "\t" << counter << " = alloc i32" << std::endl;
+    std::cout << "\tstore 0, " << counter << std::endl;
+    std::string base = gen_getelemptr_const_exp_koopa_code(pointer_array, 0, shape);
+    std::cout << "\tjump %zero_fill_cond_" << id << std::endl;
+
+    std::cout << "%zero_fill_cond_" << id << ":" << std::endl;
+    int i = result_id++;
+    std::cout << "\t%" << i << " = load " << counter << std::endl;
+    int cond = result_id++;
+    std::cout << "\t%" << cond << " = lt %" << i << ", " << size_tot << std::endl;
+    std::cout << "\tbr %" << cond << ", %zero_fill_body_" << id << ", %zero_fill_end_" << id << std::endl;
+
+    std::cout << "%zero_fill_body_" << id << ":" << std::endl;
+    int ptr = result_id++;
+    std::cout << "\t%" << ptr << " = getptr " << base << ", %" << i << std::endl;
+    std::cout << "\tstore 0, %" << ptr << std::endl;
+    int next = result_id++;
+    std::cout << "\t%" << next << " = add %" << i << ", 1" << std::endl;
+    std::cout << "\tstore %" << next << ", " << counter << std::endl;
+    std::cout << "\tjump %zero_fill_cond_" << id << std::endl;
+
+    std::cout << "%zero_fill_end_" << id << ":" << std::endl;
+}
+
 static void gen_init_val_brackets_before(int idx, const_exps_result_t &shape){
     int dim = shape.dim;
     int alignment = 1;
@@ -220,6 +272,26 @@ public:
     virtual void Dump() const = 0;
 
     virtual void Dump2StringIR(void *aux) const = 0;
+
+    /*
+        Expression as a condition: jump to `label_true` or `label_false`.
+        By default the value is computed and tested by `br`; `&&`, `||`
+        and `!` turn into control flow instead.
+    */
+    virtual void Dump2StringIRCond(const std::string &label_true,
+                                   const std::string &label_false) const {
+        exp_result_t exp_result;
+        Dump2StringIR(&exp_result);
+        if(exp_result.is_zero_depth){
+            std::cout << "\tjump ";
+            std::cout << (exp_result.result_number ? label_true : label_false);
+            std::cout << std::endl;
+        }
+        else{
+            std::cout << "\tbr %" << exp_result.result_id << ", ";
+            std::cout << label_true << ", " << label_false << std::endl;
+        }
+    }
 };
 
 /* Part 0: StartSymbol */
@@ -458,7 +530,15 @@ public:
                     << "]";
                 }
                 std::cout << std::endl;
+
+                /* the zeros go first, so that a clearing loop comes before the other stores */
+                std::stringstream init_code;
+                std::streambuf *stdout_buffer = std::cout.rdbuf(init_code.rdbuf());
                 const_init_val->Dump2StringIR(&civp);
+                std::cout.rdbuf(stdout_buffer);
+                gen_local_array_zeros(symbol_tables[cur_namespace].get_array_pointer_int(ident),
+                                      civp.zero_idx, civp.shape);
+                std::cout << init_code.str();
             }
         }
     }
@@ -560,6 +640,10 @@ public:
                     const_exp->Dump2StringIR(&const_exp_result);
                     assert(const_exp_result.is_zero_depth);
 
+                    if(const_exp_result.result_number == 0){
+                        civp->zero_idx.push_back(civp->idx++);
+                        return;
+                    }
                     std::string result_pointer = gen_getelemptr_const_exp_koopa_code(
                         symbol_tables[stack_namespace.top()].get_array_pointer_int(civp->ident),
                         civp->idx++, civp->shape
@@ -576,12 +660,7 @@ public:
                         }
 
                         for(int i = 0; i < size_tot; ++i){
-                            std::string result_pointer = gen_getelemptr_const_exp_koopa_code(
-                                symbol_tables[stack_namespace.top()].get_array_pointer_int(civp->ident),
-                                i, civp->shape
-                            );
-                            std::cout << "\tstore 0";
-                            std::cout << ", " << result_pointer << std::endl;
+                            civp->zero_idx.push_back(i);
                         }
                     }
                     else{
@@ -606,21 +685,11 @@ public:
                             const_init_vals->Dump2StringIR(aux);
                         }
                         else{
-                            std::string result_pointer = gen_getelemptr_const_exp_koopa_code(
-                                symbol_tables[stack_namespace.top()].get_array_pointer_int(civp->ident),
-                                civp->idx++, civp->shape
-                            );
-                            std::cout << "\tstore 0";
-                            std::cout << ", " << result_pointer << std::endl;
+                            civp->zero_idx.push_back(civp->idx++);
                         }
 
                         while(civp->idx % alignment != 0){
-                            std::string result_pointer = gen_getelemptr_const_exp_koopa_code(
-                                symbol_tables[stack_namespace.top()].get_array_pointer_int(civp->ident),
-                                civp->idx++, civp->shape
-                            );
-                            std::cout << "\tstore 0";
-                            std::cout << ", " << result_pointer << std::endl;
+                            civp->zero_idx.push_back(civp->idx++);
                         }
 
                         /* restore level */
@@ -945,7 +1014,15 @@ public:
                         << "]";
                     }
                     std::cout << std::endl;
+
+                    /* the zeros go first, so that a clearing loop comes before the other stores */
+                    std::stringstream init_code;
+                    std::streambuf *stdout_buffer = std::cout.rdbuf(init_code.rdbuf());
                     init_val->Dump2StringIR(&ivp);
+                    std::cout.rdbuf(stdout_buffer);
+                    gen_local_array_zeros(symbol_tables[cur_namespace].get_array_pointer_int(ident),
+                                          ivp.zero_idx, ivp.shape);
+                    std::cout << init_code.str();
                 }
             }
         }
@@ -1041,6 +1118,10 @@ public:
                     exp_result_t exp_result;
                     exp->Dump2StringIR(&exp_result);
 
+                    if(exp_result.is_zero_depth && exp_result.result_number == 0){
+                        ivp->zero_idx.push_back(ivp->idx++);
+                        return;
+                    }
                     std::string result_pointer = gen_getelemptr_const_exp_koopa_code(
                         symbol_tables[stack_namespace.top()].get_array_pointer_int(ivp->ident),
                         ivp->idx++, ivp->shape
@@ -1063,12 +1144,7 @@ public:
                         }
 
                         for(int i = 0; i < size_tot; ++i){
-                            std::string result_pointer = gen_getelemptr_const_exp_koopa_code(
-                                symbol_tables[stack_namespace.top()].get_array_pointer_int(ivp->ident),
-                                i, ivp->shape
-                            );
-                            std::cout << "\tstore 0";
-                            std::cout << ", " << result_pointer << std::endl;
+                            ivp->zero_idx.push_back(i);
                         }
                     }
                     else{
@@ -1090,21 +1166,11 @@ public:
                             init_vals->Dump2StringIR(aux);
                         }
                         else{
-                            std::string result_pointer = gen_getelemptr_const_exp_koopa_code(
-                                symbol_tables[stack_namespace.top()].get_array_pointer_int(ivp->ident),
-                                ivp->idx++, ivp->shape
-                            );
-                            std::cout << "\tstore 0";
-                            std::cout << ", " << result_pointer << std::endl;
+                            ivp->zero_idx.push_back(ivp->idx++);
                         }
 
                         while(ivp->idx % alignment != 0){
-                            std::string result_pointer = gen_getelemptr_const_exp_koopa_code(
-                                symbol_tables[stack_namespace.top()].get_array_pointer_int(ivp->ident),
-                                ivp->idx++, ivp->shape
-                            );
-                            std::cout << "\tstore 0";
-                            std::cout << ", " << result_pointer << std::endl;
+                            ivp->zero_idx.push_back(ivp->idx++);
                         }
 
                         ivp->level = old_level;
@@ -1592,15 +1658,8 @@ public:
             std::cout << "%after_ret_" << ret_id << ":" << std::endl;
             break;
         case STMT_IF_STMT:
-            exp->Dump2StringIR(&exp_result);
-            if(exp_result.is_zero_depth){
-                std::cout << "\tbr " << exp_result.result_number << ", ";
-            }
-            else{
-                std::cout << "\tbr %" << exp_result.result_id << ", ";
-            }
-            std::cout << "%then_" << if_stmt_id << ", ";
-            std::cout << "%else_" << if_stmt_id << std::endl;
+            exp->Dump2StringIRCond("%then_" + std::to_string(if_stmt_id),
+                                   "%else_" + std::to_string(if_stmt_id));
 
             std::cout << "%then_" << if_stmt_id << ":" << std::endl;
             stmt_true->Dump2StringIR(nullptr);
@@ -1618,15 +1677,8 @@ public:
             std::cout << "\tjump %while_cond_" << while_id << std::endl;
 
             std::cout << "%while_cond_" << while_id << ":" << std::endl;
-            exp->Dump2StringIR(&exp_result);
-            if(exp_result.is_zero_depth){
-                std::cout << "\tbr " << exp_result.result_number << ", ";
-            }
-            else{
-                std::cout << "\tbr %" << exp_result.result_id << ", ";
-            }
-            std::cout << "%while_body_" << while_id << ", ";
-            std::cout << "%while_end_" << while_id << std::endl;
+            exp->Dump2StringIRCond("%while_body_" + std::to_string(while_id),
+                                   "%while_end_" + std::to_string(while_id));
 
             std::cout << "%while_body_" << while_id << ":" << std::endl;
             stmt_body->Dump2StringIR(nullptr);
@@ -1708,19 +1760,11 @@ public:
     }
 
     void Dump2StringIR(void *aux [[maybe_unused]]) const override {
-        exp_result_t exp_result;
         switch (type)
         {
         case OPEN_STMT_IF_GENERAL_STMT:
-            exp->Dump2StringIR(&exp_result);
-            if(exp_result.is_zero_depth){
-                std::cout << "\tbr " << exp_result.result_number << ", ";
-            }
-            else{
-                std::cout << "\tbr %" << exp_result.result_id << ", ";
-            }
-            std::cout << "%then_" << if_stmt_id << ", ";
-            std::cout << "%end_" << if_stmt_id << std::endl;
+            exp->Dump2StringIRCond("%then_" + std::to_string(if_stmt_id),
+                                   "%end_" + std::to_string(if_stmt_id));
 
             std::cout << "%then_" << if_stmt_id << ":" << std::endl;
             stmt_true->Dump2StringIR(nullptr);
@@ -1729,15 +1773,8 @@ public:
             std::cout << "%end_" << if_stmt_id << ":" << std::endl;
             break;
         case OPEN_STMT_IF_STMT_OPEN_STMT:
-            exp->Dump2StringIR(&exp_result);
-            if(exp_result.is_zero_depth){
-                std::cout << "\tbr " << exp_result.result_number << ", ";
-            }
-            else{
-                std::cout << "\tbr %" << exp_result.result_id << ", ";
-            }
-            std::cout << "%then_" << if_stmt_id << ", ";
-            std::cout << "%else_" << if_stmt_id << std::endl;
+            exp->Dump2StringIRCond("%then_" + std::to_string(if_stmt_id),
+                                   "%else_" + std::to_string(if_stmt_id));
 
             std::cout << "%then_" << if_stmt_id << ":" << std::endl;
             stmt_true->Dump2StringIR(nullptr);
@@ -1755,15 +1792,8 @@ public:
             std::cout << "\tjump %while_cond_" << while_id << std::endl;
 
             std::cout << "%while_cond_" << while_id << ":" << std::endl;
-            exp->Dump2StringIR(&exp_result);
-            if(exp_result.is_zero_depth){
-                std::cout << "\tbr " << exp_result.result_number << ", ";
-            }
-            else{
-                std::cout << "\tbr %" << exp_result.result_id << ", ";
-            }
-            std::cout << "%while_body_" << while_id << ", ";
-            std::cout << "%while_end_" << while_id << std::endl;
+            exp->Dump2StringIRCond("%while_body_" + std::to_string(while_id),
+                                   "%while_end_" + std::to_string(while_id));
 
             std::cout << "%while_body_" << while_id << ":" << std::endl;
             stmt_body->Dump2StringIR(nullptr);
@@ -1795,6 +1825,10 @@ public:
     void Dump2StringIR(void *aux) const override {
         l_or_exp->Dump2StringIR(aux);
     }
+    void Dump2StringIRCond(const std::string &label_true,
+                           const std::string &label_false) const override {
+        l_or_exp->Dump2StringIRCond(label_true, label_false);
+    }
 };
 
 /* LVal          ::= IDENT; */
@@ -2060,6 +2094,15 @@ public:
             break;
         }
     }
+    void Dump2StringIRCond(const std::string &label_true,
+                           const std::string &label_false) const override {
+        if(type == PRIMARY_EXP_EXP){
+            exp->Dump2StringIRCond(label_true, label_false);
+        }
+        else{
+            BaseAST::Dump2StringIRCond(label_true, label_false);
+        }
+    }
 };
 
 /*
@@ -2212,6 +2255,18 @@ public:
             break;
         }
     }
+    void Dump2StringIRCond(const std::string &label_true,
+                           const std::string &label_false) const override {
+        if(type == UNARY_EXP_PRIMARY_EXP){
+            primary_exp->Dump2StringIRCond(label_true, label_false);
+        }
+        else if(type == UNARY_EXP_UNARY_OP_EXP && unary_op == "!"){
+            unary_exp->Dump2StringIRCond(label_false, label_true);
+        }
+        else{
+            BaseAST::Dump2StringIRCond(label_true, label_false);
+        }
+    }
 };
 
 /* FuncRParams ::= Exp {"," Exp}; */
@@ -2337,6 +2392,15 @@ public:
             }
         }
     }
+    void Dump2StringIRCond(const std::string &label_true,
+                           const std::string &label_false) const override {
+        if(type == MUL_EXP_UNARY){
+            unary_exp->Dump2StringIRCond(label_true, label_false);
+        }
+        else{
+            BaseAST::Dump2StringIRCond(label_true, label_false);
+        }
+    }
 };
 
 /* AddExp      ::= MulExp | AddExp ("+" | "-") MulExp; */
@@ -2424,6 +2488,15 @@ public:
             }
         }
     }
+    void Dump2StringIRCond(const std::string &label_true,
+                           const std::string &label_false) const override {
+        if(type == ADD_EXP_MUL){
+            mul_exp->Dump2StringIRCond(label_true, label_false);
+        }
+        else{
+            BaseAST::Dump2StringIRCond(label_true, label_false);
+        }
+    }
 };
 
 /* RelExp      ::= AddExp | RelExp ("<" | ">" | "<=" | ">=") AddExp; */
@@ -2513,6 +2586,15 @@ public:
             }
         }
     }
+    void Dump2StringIRCond(const std::string &label_true,
+                           const std::string &label_false) const override {
+        if(type == REL_EXP_ADD){
+            add_exp->Dump2StringIRCond(label_true, label_false);
+        }
+        else{
+            BaseAST::Dump2StringIRCond(label_true, label_false);
+        }
+    }
 };
 
 /* EqExp       ::= RelExp | EqExp ("==" | "!=") RelExp; */
@@ -2588,6 +2670,15 @@ public:
             }
         }
     }
+    void Dump2StringIRCond(const std::string &label_true,
+                           const std::string &label_false) const override {
+        if(type == EQ_EXP_REL){
+            rel_exp->Dump2StringIRCond(label_true, label_false);
+        }
+        else{
+            BaseAST::Dump2StringIRCond(label_true, label_false);
+        }
+    }
 };
 
 /* LAndExp     ::= EqExp | LAndExp "&&" EqExp; */
@@ -2647,53 +2738,42 @@ public:
                 }
             }
             else{
-                std::cout << "\t%tmp_l_and_exp_" << id;
-                std::cout << " = alloc i32" << std::endl;
-
-                std::cout << "\tstore 0, %tmp_l_and_exp_" << id;
-                std::cout << std::endl;
+                /* the value is a block param: 1 from the true edge, 0 from the false one */
+                std::string label_rhs = "%rhs_l_and_exp_" + std::to_string(id);
+                std::string label_true = "%true_l_and_exp_" + std::to_string(id);
+                std::string label_false = "%false_l_and_exp_" + std::to_string(id);
+                std::string label_end = "%end_l_and_exp_" + std::to_string(id);
 
                 std::cout << "\tbr %" << result1.result_id << ", ";
-                std::cout << "%then_l_and_exp_" << id << ", ";
-                std::cout << "%end_l_and_exp_" << id << std::endl;
-
-                std::cout << "%then_l_and_exp_" << id << ":" << std::endl;
+                std::cout << label_rhs << ", " << label_false << std::endl;
 
-                eq_exp->Dump2StringIR(&result2);
+                std::cout << label_rhs << ":" << std::endl;
+                eq_exp->Dump2StringIRCond(label_true, label_false);
 
-                std::cout << "\t%" << result_id++ << " = ne 0, ";
-                std::cout << "%" << result1.result_id << std::endl;
-
-                std::cout << "\t%" << result_id++ << " = ne 0, ";
-                if(result2.is_zero_depth){
-                    std::cout << result2.result_number;
-                }
-                else{
-                    std::cout << "%" << result2.result_id;
-                }
-                std::cout << std::endl;
+                std::cout << label_true << ":" << std::endl;
+                std::cout << "\tjump " << label_end << "(1)" << std::endl;
+                std::cout << label_false << ":" << std::endl;
+                std::cout << "\tjump " << label_end << "(0)" << std::endl;
 
                 result->is_zero_depth = false;
                 result->result_id = result_id++;
-
-                std::cout   << "\t%" << result->result_id << " = and %"
-                            << result->result_id - 1 << ", %"
-                            << result->result_id - 2
-                            << std::endl;
-
-                std::cout << "\t store %" << result->result_id;
-                std::cout << ", %tmp_l_and_exp_" << id << std::endl;
-
-                std::cout << "\tjump %end_l_and_exp_" << id << std::endl;
-
-                std::cout << "%end_l_and_exp_" << id << ":" << std::endl;
-
-                result->result_id = result_id++;
-                std::cout << "\t %" << result->result_id << " = load ";
-                std::cout << "%tmp_l_and_exp_" << id << std::endl;
+                std::cout << label_end << "(%" << result->result_id;
+                std::cout << ": i32):" << std::endl;
             }
         }
     }
+    void Dump2StringIRCond(const std::string &label_true,
+                           const std::string &label_false) const override {
+        if(type == L_AND_EXP_EQ){
+            eq_exp->Dump2StringIRCond(label_true, label_false);
+        }
+        else{
+            std::string label_rhs = "%rhs_l_and_exp_" + std::to_string(id);
+            l_and_exp->Dump2StringIRCond(label_rhs, label_false);
+            std::cout << label_rhs << ":" << std::endl;
+            eq_exp->Dump2StringIRCond(label_true, label_false);
+        }
+    }
 };
 
 /* LOrExp      ::= LAndExp | LOrExp "||" LAndExp; */
@@ -2753,48 +2833,42 @@ public:
                 }
             }
             else{
-                std::cout << "\t%tmp_l_or_exp_" << id;
-                std::cout << " = alloc i32" << std::endl;
-
-                std::cout << "\tstore 1, %tmp_l_or_exp_" << id;
-                std::cout << std::endl;
+                /* the value is a block param: 1 from the true edge, 0 from the false one */
+                std::string label_rhs = "%rhs_l_or_exp_" + std::to_string(id);
+                std::string label_true = "%true_l_or_exp_" + std::to_string(id);
+                std::string label_false = "%false_l_or_exp_" + std::to_string(id);
+                std::string label_end = "%end_l_or_exp_" + std::to_string(id);
 
                 std::cout << "\tbr %" << result1.result_id << ", ";
-                std::cout << "%end_l_or_exp_" << id << ", ";
-                std::cout << "%then_l_or_exp_" << id << std::endl;
-
-                std::cout << "%then_l_or_exp_" << id << ":" << std::endl;
+                std::cout << label_true << ", " << label_rhs << std::endl;
 
-                l_and_exp->Dump2StringIR(&result2);
+                std::cout << label_rhs << ":" << std::endl;
+                l_and_exp->Dump2StringIRCond(label_true, label_false);
 
-                std::cout << "\t%" << result_id++ << " = or ";
-                std::cout << "%" << result1.result_id << ", ";
-                if(result2.is_zero_depth){
-                    std::cout << result2.result_number;
-                }
-                else{
-                    std::cout << "%" << result2.result_id;
-                }
-                std::cout << std::endl;
+                std::cout << label_true << ":" << std::endl;
+                std::cout << "\tjump " << label_end << "(1)" << std::endl;
+                std::cout << label_false << ":" << std::endl;
+                std::cout << "\tjump " << label_end << "(0)" << std::endl;
 
                 result->is_zero_depth = false;
                 result->result_id = result_id++;
-                std::cout << "\t%" << result->result_id << " = ne 0, %";
-                std::cout << result->result_id - 1 << std::endl;
-
-                std::cout << "\tstore %" << result->result_id;
-                std::cout << ", %tmp_l_or_exp_" << id << std::endl;
-
-                std::cout << "\tjump %end_l_or_exp_" << id << std::endl;
-
-                std::cout << "%end_l_or_exp_" << id << ":" << std::endl;
-
-                result->result_id = result_id++;
-                std::cout << "\t%" << result->result_id << " = load ";
-                std::cout << "%tmp_l_or_exp_" << id << std::endl;
+                std::cout << label_end << "(%" << result->result_id;
+                std::cout << ": i32):" << std::endl;
             }
         }
     }
+    void Dump2StringIRCond(const std::string &label_true,
+                           const std::string &label_false) const override {
+        if(type == L_OR_EXP_L_AND){
+            l_and_exp->Dump2StringIRCond(label_true, label_false);
+        }
+        else{
+            std::string label_rhs = "%rhs_l_or_exp_" + std::to_string(id);
+            l_or_exp->Dump2StringIRCond(label_true, label_rhs);
+            std::cout << label_rhs << ":" << std::endl;
+            l_and_exp->Dump2StringIRCond(label_true, label_false);
+        }
+    }
 };
 
 /* ConstExp      ::= Exp; */
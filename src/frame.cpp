@@ -1,7 +1,11 @@
 #include "frame.h"
+#include "ir.h"
+#include "regalloc.h"
 
+#include <algorithm>
 #include <cassert>
 #include <iostream>
+#include <set>
 
 size_t size_of_type(const koopa_raw_type_t &ty){
     switch (ty->tag)
@@ -43,6 +47,84 @@ size_t len_of_type(const koopa_raw_type_t &ty){
     }
 }
 
+typedef std::vector<std::pair<koopa_raw_value_t, koopa_raw_basic_block_t> > user_list_t;
+
+/* Not derived from an `alloc` of the current frame */
+static bool is_outside_frame(koopa_raw_value_t value){
+    while(value->kind.tag == KOOPA_RVT_GET_ELEM_PTR || value->kind.tag == KOOPA_RVT_GET_PTR){
+        value = (value->kind.tag == KOOPA_RVT_GET_ELEM_PTR)
+                ? value->kind.data.get_elem_ptr.src : value->kind.data.get_ptr.src;
+    }
+    return value->ty->tag != KOOPA_RTT_POINTER
+        || value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC || value->kind.tag == KOOPA_RVT_FUNC_ARG_REF;
+}
+
+/* Reached from sp by constant offsets only */
+static bool is_frame_address(koopa_raw_value_t ptr){
+    if(ptr->kind.tag == KOOPA_RVT_ALLOC){
+        return true;
+    }
+    if(ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR){
+        return ptr->kind.data.get_elem_ptr.index->kind.tag == KOOPA_RVT_INTEGER
+            && is_frame_address(ptr->kind.data.get_elem_ptr.src);
+    }
+    if(ptr->kind.tag == KOOPA_RVT_GET_PTR){
+        return ptr->kind.data.get_ptr.index->kind.tag == KOOPA_RVT_INTEGER
+            && is_frame_address(ptr->kind.data.get_ptr.src);
+    }
+    return false;
+}
+
+static bool is_foldable(koopa_raw_value_t ptr, koopa_raw_basic_block_t bb,
+        std::map<koopa_raw_value_t, user_list_t> &users,
+        std::map<koopa_raw_value_t, bool> &memo){
+    koopa_raw_value_t index;
+    if(ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR){
+        index = ptr->kind.data.get_elem_ptr.index;
+    }
+    else if(ptr->kind.tag == KOOPA_RVT_GET_PTR){
+        index = ptr->kind.data.get_ptr.index;
+    }
+    else{
+        return false;
+    }
+    auto it = memo.find(ptr);
+    if(it != memo.end()){
+        return it->second;
+    }
+
+    bool is_same_block = true;
+    bool is_ok = true;
+    for(auto &use : users[ptr]){
+        auto user = use.first;
+        is_same_block &= (use.second == bb);
+        if(user->kind.tag == KOOPA_RVT_LOAD){
+            continue;
+        }
+        if(user->kind.tag == KOOPA_RVT_STORE && user->kind.data.store.value != ptr){
+            continue;
+        }
+        if((user->kind.tag == KOOPA_RVT_GET_ELEM_PTR && user->kind.data.get_elem_ptr.src == ptr)
+            || (user->kind.tag == KOOPA_RVT_GET_PTR && user->kind.data.get_ptr.src == ptr)){
+            if(is_foldable(user, use.second, users, memo)){
+                continue;
+            }
+        }
+        is_ok = false;
+    }
+    if(is_ok){
+        if(index->kind.tag == KOOPA_RVT_INTEGER){
+            is_ok = is_same_block || is_frame_address(ptr);
+        }
+        else{
+            is_ok = is_same_block && users[ptr].size() == 1;
+        }
+    }
+    memo[ptr] = is_ok;
+    return is_ok;
+}
+
+/* func_scan_inst_for_stack_space */
 /* func_scan_inst_for_stack_space */
 void func_alloc_frame(const koopa_raw_function_t &func){
     size_t frame_size;
@@ -78,19 +160,221 @@ void func_alloc_frame(const koopa_raw_function_t &func){
 
     frame_size += (max_num_args > 8) ? (4 * (max_num_args - 8)) : 0;
 
+    /*
+        Params read directly by instructions (after mem2reg) need a slot;
+        the ones only copied by `store` into an `alloc` are read from a0-a7
+        at that point.
+    */
+    std::set<koopa_raw_value_t> used_values;
+    std::map<koopa_raw_value_t, int> num_uses;
+    for(size_t i = 0; i < func->bbs.len; ++i){
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        for(size_t j = 0; j < bb->insts.len; ++j){
+            auto ptr = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+            for(auto operand : ir_operands(ptr)){
+                num_uses[operand]++;
+                if(!(operand->kind.tag == KOOPA_RVT_FUNC_ARG_REF
+                    && ptr->kind.tag == KOOPA_RVT_STORE
+                    && ptr->kind.data.store.value == operand
+                    && ptr->kind.data.store.dest->kind.tag == KOOPA_RVT_ALLOC)){
+                    used_values.insert(operand);
+                }
+            }
+        }
+    }
+
+    /*
+        A comparison used only by the `br` ending its block becomes part of
+        the branch (blt, beq, ...) and needs no slot
+    */
+    fused_branch_conds.clear();
+    for(size_t i = 0; i < func->bbs.len; ++i){
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        auto term = ir_terminator(bb);
+        if(term->kind.tag != KOOPA_RVT_BRANCH){
+            continue;
+        }
+        auto cond = term->kind.data.branch.cond;
+        if(cond->kind.tag != KOOPA_RVT_BINARY || num_uses[cond] != 1){
+            continue;
+        }
+        switch (cond->kind.data.binary.op)
+        {
+        case KOOPA_RBO_NOT_EQ:
+        case KOOPA_RBO_EQ:
+        case KOOPA_RBO_GT:
+        case KOOPA_RBO_LT:
+        case KOOPA_RBO_GE:
+        case KOOPA_RBO_LE:
+            break;
+        default:
+            continue;
+        }
+        for(size_t j = 0; j < bb->insts.len; ++j){
+            if(bb->insts.buffer[j] == cond){
+                fused_branch_conds.insert(cond);
+            }
+        }
+    }
+    /*
+        Addresses only used by loads and stores (directly or through other
+        folded addresses) get no slot: each use computes base + offset and
+        puts the constant part into the immediate of `lw`/`sw`. A variable
+        index is only repeated for a single use in the same block.
+    */
+    folded_addrs.clear();
+    std::map<koopa_raw_value_t, user_list_t> users;
+    for(size_t i = 0; i < func->bbs.len; ++i){
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        for(size_t j = 0; j < bb->insts.len; ++j){
+            auto ptr = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+            for(auto operand : ir_operands(ptr)){
+                users[operand].push_back({ptr, bb});
+            }
+        }
+    }
+    std::map<koopa_raw_value_t, bool> memo;
+    for(size_t i = 0; i < func->bbs.len; ++i){
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        for(size_t j = 0; j < bb->insts.len; ++j){
+            auto ptr = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+            if(is_foldable(ptr, bb, users, memo)){
+                folded_addrs.insert(ptr);
+            }
+        }
+    }
+
+    /*
+        A call whose result is returned right away, with its arguments all
+        in registers and none pointing into this frame, becomes `tail`
+        after the epilogue; the `ret` goes with it.
+    */
+    tail_calls.clear();
+    for(size_t i = 0; i < func->bbs.len; ++i){
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        auto ret = ir_terminator(bb);
+        if(ret->kind.tag != KOOPA_RVT_RETURN || bb->insts.len < 2){
+            continue;
+        }
+        auto call = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 2]);
+        if(call->kind.tag != KOOPA_RVT_CALL || call->kind.data.call.args.len > 8
+            || (ret->kind.data.ret.value != call
+                && (ret->kind.data.ret.value != nullptr || call->ty->tag != KOOPA_RTT_UNIT))){
+            continue;
+        }
+        bool is_ok = true;
+        for(auto arg : ir_values(call->kind.data.call.args)){
+            is_ok &= is_outside_frame(arg);
+        }
+        if(is_ok){
+            tail_calls.insert(call);
+            tail_calls.insert(ret);
+        }
+    }
+
+    /*
+        Values are kept in registers where they fit; the t registers are
+        the scratch ones of every instruction and hold nothing across.
+    */
+    std::set<koopa_raw_value_t> candidates;
+    for(size_t i = 0; i < func->params.len && i < 8; ++i){
+        auto param = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]);
+        if(num_uses[param] > 0){
+            candidates.insert(param);
+        }
+    }
+    for(size_t i = 0; i < func->bbs.len; ++i){
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        for(auto param : ir_values(bb->params)){
+            candidates.insert(param);
+        }
+        for(auto inst : ir_values(bb->insts)){
+            bool is_result_used = inst->kind.tag != KOOPA_RVT_CALL
+                                || (used_values.count(inst) && !tail_calls.count(inst));
+            if((inst->ty->tag == KOOPA_RTT_INT32 && !fused_branch_conds.count(inst) && is_result_used)
+                || (inst->ty->tag == KOOPA_RTT_POINTER && inst->kind.tag != KOOPA_RVT_ALLOC
+                    && !folded_addrs.count(inst))){
+                candidates.insert(inst);
+            }
+        }
+    }
+    reg_assignment_t regs;
+    regalloc_run(func, candidates, regs);
+    for(auto &home : regs.homes){
+        (*frame)[home.first].reg = home.second;
+    }
+    for(auto &home : regs.early_homes){
+        (*frame)[home.first].early_reg = home.second;
+    }
+    frame_wrap_t &wrap = map_frame2wrap[frame];
+    wrap.save_bb = regs.save_bb;
+    wrap.early_bbs = regs.early_bbs;
+    wrap.save_live_in = regs.save_live_in;
+    wrap.saved_regs.clear();
+    for(int k = 0; k < 12; ++k){
+        std::string reg = "s" + std::to_string(k);
+        for(auto &home : regs.homes){
+            if(home.second == reg){
+                wrap.saved_regs.push_back(reg);
+                break;
+            }
+        }
+    }
+
+    /* In a register, or only used before the frame is set up */
+    auto is_slotless = [&](koopa_raw_value_t value, koopa_raw_basic_block_t bb){
+        auto it = (*frame).find(value);
+        if(it != (*frame).end() && !it->second.reg.empty()){
+            return true;
+        }
+        return wrap.early_bbs.count(bb)
+            && std::find(wrap.save_live_in.begin(), wrap.save_live_in.end(), value) == wrap.save_live_in.end();
+    };
+
+    auto entry = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]);
+    for(size_t i = 0; i < func->params.len; ++i){
+        auto param = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]);
+        if(i < 8 && is_slotless(param, entry)){
+            continue;
+        }
+        if(num_uses[param] > 0 && i < 8){
+            (*frame)[param].offset = frame_size;
+            frame_size += SIZE_INT32;
+        }
+    }
+
     for(size_t i = 0; i < func->bbs.len; ++i){
         auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
         assert(bb->insts.kind == KOOPA_RSIK_VALUE);
         // std::cerr << "bb " << i << "\n";
+        /* Block params (phi) */
+        for(size_t j = 0; j < bb->params.len; ++j){
+            auto ptr = reinterpret_cast<koopa_raw_value_t>(bb->params.buffer[j]);
+            if(is_slotless(ptr, bb)){
+                continue;
+            }
+            (*frame)[ptr].offset = frame_size;
+            frame_size += SIZE_INT32;
+        }
         for(size_t j = 0; j < bb->insts.len; ++j){
             // std::cerr << "\tinstr " << j << "\n";
             auto ptr = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
 // std::cerr << "\tvalue ret type: " << ptr->ty->tag << "\n";
+            if(candidates.count(ptr) && is_slotless(ptr, bb)){
+                continue;
+            }
             switch (ptr->ty->tag)
             {
             case KOOPA_RTT_INT32:
                 /* Intermediate result */
                 assert(ptr->name == nullptr);
+                if(ptr->kind.tag == KOOPA_RVT_CALL && used_values.count(ptr) == 0){
+                    /* Return value ignored */
+                    break;
+                }
+                if(fused_branch_conds.count(ptr) || tail_calls.count(ptr)){
+                    break;
+                }
                 (*frame)[ptr].offset = frame_size;
                 frame_size += size_of_type(ptr->ty);
                 // std::cerr << "int " << frame_size - (*frame)[ptr].offset << "\n";
@@ -99,6 +383,9 @@ void func_alloc_frame(const koopa_raw_function_t &func){
                 /* No need of alloc */
                 break;
             case KOOPA_RTT_POINTER:
+                if(folded_addrs.count(ptr)){
+                    break;
+                }
                 (*frame)[ptr].offset = frame_size;
                 // (*frame)[ptr].array_elem_size =
                 if(ptr->kind.tag == KOOPA_RVT_ALLOC){
@@ -128,11 +415,20 @@ void func_alloc_frame(const koopa_raw_function_t &func){
     if(is_with_call){
         frame_size += 4;
     }
+    frame_size += SIZE_INT32 * wrap.saved_regs.size();
 
     frame_size = (frame_size + STACK_ALIGNMENT - 1 )
                 / STACK_ALIGNMENT
                 * STACK_ALIGNMENT;
 
+    /* Params beyond a7 stay in the caller's frame */
+    for(size_t i = 8; i < func->params.len; ++i){
+        auto param = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]);
+        if(used_values.count(param)){
+            (*frame)[param].offset = frame_size + (i - 8) * SIZE_INT32;
+        }
+    }
+
     map_frame2size[frame] = frame_size;
     map_frame2is_with_call[frame] = is_with_call;
 }
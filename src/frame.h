@@ -2,7 +2,9 @@
 #define FRAME_H
 
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "koopa.h"
 
@@ -14,6 +16,8 @@
 typedef struct{
     size_t offset;
     size_t array_elem_size;
+    std::string reg;        /* home register, kept there instead of `offset` */
+    std::string early_reg;  /* home in the blocks run before the frame is set up */
 } frame_entry_t;
 
 // typedef std::map<std::string, frame_entry_t> frame_t;
@@ -21,11 +25,29 @@ typedef std::map<koopa_raw_value_t, frame_entry_t> frame_t;
 typedef std::map<std::string, frame_t> frames_t;
 typedef std::map<frame_t *, size_t> map_frame2size_t;
 typedef std::map<frame_t *, bool> map_frame2bool_t;
+typedef std::set<koopa_raw_value_t> value_set_t;
+
+/*
+    Where the frame is set up and what it saves (see `regalloc.h`): the
+    prologue is at the top of `save_bb`, nullptr for no frame at all.
+    Returns after it share one epilogue.
+*/
+typedef struct{
+    koopa_raw_basic_block_t save_bb;
+    std::set<koopa_raw_basic_block_t> early_bbs;
+    std::vector<koopa_raw_value_t> save_live_in;    /* moved from `early_reg` in the prologue */
+    std::vector<std::string> saved_regs;            /* s registers, saved below `ra` */
+} frame_wrap_t;
+typedef std::map<frame_t *, frame_wrap_t> map_frame2wrap_t;
 
 extern frames_t frames;
 extern frame_t *frame;
 extern map_frame2size_t map_frame2size;
 extern map_frame2bool_t map_frame2is_with_call;
+extern map_frame2wrap_t map_frame2wrap;
+extern value_set_t fused_branch_conds;
+extern value_set_t folded_addrs;
+extern value_set_t tail_calls;
 
 size_t size_of_type(const koopa_raw_type_t &ty);
 
@@ -2,16 +2,24 @@
 #include "frame.h"
 #include "array.h"
 #include "riscv.h"
+#include "opt.h"
+#include "peephole.h"
 
 #include <iostream>
 #include <cassert>
 #include <map>
 #include <string>
+#include <utility>
+#include <vector>
 
  frames_t frames;
  frame_t *frame;
  map_frame2size_t map_frame2size;
  map_frame2bool_t map_frame2is_with_call;
+map_frame2wrap_t map_frame2wrap;
+ value_set_t fused_branch_conds;
+ value_set_t folded_addrs;
+value_set_t tail_calls;
 
  int register_counter = 0;
 
@@ -19,6 +27,20 @@ static std::string rd, rs1, rs2, rs;
 
 static std::map<koopa_raw_value_t, std::string> globl2name;
 
+static int edge_label_id = 0;
+
+/* Block laid out right after the current one; jumps to it fall through */
+static koopa_raw_basic_block_t next_bb = nullptr;
+
+/* In a block run before the frame is set up: values are in `early_reg` */
+static bool is_early = false;
+
+/* The shared epilogue, once emitted by the first return after the prologue */
+static std::string epilogue_label;
+static int epilogue_label_id = 0;
+
+static void gen_prologue();
+
 void Visit(const koopa_raw_program_t &program);
 
 void Visit(const koopa_raw_slice_t &slice);
@@ -42,8 +64,9 @@ void Visit(const koopa_raw_get_ptr_t &get_ptr, const koopa_raw_value_t &value);
  * @brief string Koopa IR --(libkoopa)--> Koopa raw program --(Visit)--> RISCV
  *
  * @param str string-form Koopa IR
+ * @param optimize run the IR passes in `opt/` before generating RISCV
  */
-void libkoopa_string2rawprog2riscv(const char *str){
+void libkoopa_string2rawprog2riscv(const char *str, bool optimize){
     koopa_program_t program;
 
     koopa_error_code_t ret = koopa_parse_from_string(str, &program);
@@ -53,9 +76,37 @@ void libkoopa_string2rawprog2riscv(const char *str){
     koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
     koopa_delete_program(program);
 
+    if(optimize){
+        opt_program(raw);
+    }
+    peephole_enabled = optimize;
+
     std::cerr << "DEBUG: RISCV generation started." << std::endl;
     Visit(raw);
     std::cerr << "DEBUG: RISCV generation ended." << std::endl;
+    if(optimize){
+        peephole_report();
+    }
+
+    koopa_delete_raw_program_builder(builder);
+}
+
+/**
+ * @brief string Koopa IR --(libkoopa)--> Koopa raw program --> alias analysis dump
+ *
+ * @param str string-form Koopa IR
+ */
+void libkoopa_string2alias_dump(const char *str){
+    koopa_program_t program;
+
+    koopa_error_code_t ret = koopa_parse_from_string(str, &program);
+    assert(ret == KOOPA_EC_SUCCESS);
+
+    koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
+    koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
+    koopa_delete_program(program);
+
+    opt_dump_alias(raw);
 
     koopa_delete_raw_program_builder(builder);
 }
@@ -110,20 +161,24 @@ void Visit(const koopa_raw_function_t &func){
     }
 
     func_alloc_frame(func);
+    riscv_function_begin();
 
     std::cout << "\t.globl " << func->name + 1 << std::endl;
     std::cout << func->name + 1 << ": " << std::endl;
 
-    /* Prologue */
-    size_t frame_size = map_frame2size[frame];
-    gen_addi("sp", "sp", -(int32_t)frame_size);
-    if(map_frame2is_with_call[frame]){
-        gen_sw("ra", (int32_t)(frame_size - 4), "sp");
-    }
+    /* The prologue goes to the top of the save block */
+    epilogue_label.clear();
 
-    std::cout << std::endl;
+    assert(func->bbs.kind == KOOPA_RSIK_BASIC_BLOCK);
+    for(size_t i = 0; i < func->bbs.len; ++i){
+        next_bb = (i + 1 < func->bbs.len)
+                ? reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i + 1])
+                : nullptr;
+        Visit(reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]));
+    }
+    next_bb = nullptr;
 
-    Visit(func->bbs);
+    riscv_function_end();
 }
 
 void Visit(const koopa_raw_basic_block_t &bb){
@@ -131,6 +186,11 @@ void Visit(const koopa_raw_basic_block_t &bb){
     if(std::string(bb->name) != "%entry"){
         std::cout << bb->name + 1 << ":" << std::endl;
     }
+    is_early = map_frame2wrap[frame].early_bbs.count(bb);
+    if(bb == map_frame2wrap[frame].save_bb){
+        gen_prologue();
+        std::cout << std::endl;
+    }
 
     Visit(bb->insts);
 }
@@ -187,6 +247,10 @@ void Visit(const koopa_raw_value_t &value){
         break;
     case KOOPA_RVT_RETURN:
         /* No LVal */
+        if(tail_calls.count(value)){
+            /* Done by the tail call */
+            break;
+        }
         Visit(kind.data.ret);
         break;
     default:
@@ -198,28 +262,424 @@ void Visit(const koopa_raw_value_t &value){
     std::cout << std::endl;
 }
 
-void Visit(const koopa_raw_return_t &ret){
-    /* load return value if necessary */
-    if(ret.value != nullptr){
-        if(ret.value->kind.tag == KOOPA_RVT_INTEGER){
-            gen_li("a0", ret.value->kind.data.integer.value);
+/* Register `value` is kept in, or "" if it has a slot */
+static std::string home_of(const koopa_raw_value_t &value){
+    auto it = (*frame).find(value);
+    if(it == (*frame).end()){
+        return "";
+    }
+    return is_early ? it->second.early_reg : it->second.reg;
+}
+
+/* Operand -> register: integer, address of an alloc / global, its home or its slot */
+static void gen_load_operand(const std::string &reg, const koopa_raw_value_t &value){
+    std::string home = home_of(value);
+    if(!home.empty()){
+        if(home != reg){
+            gen_mv(reg, home);
+        }
+    }
+    else if(value->kind.tag == KOOPA_RVT_INTEGER){
+        gen_li(reg, value->kind.data.integer.value);
+    }
+    else if(value->kind.tag == KOOPA_RVT_ALLOC){
+        assert((*frame).find(value) != (*frame).end());
+        gen_addi(reg, "sp", (int32_t)(*frame)[value].offset);
+    }
+    else if(value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC){
+        gen_la(reg, globl2name[value]);
+    }
+    else{
+        assert((*frame).find(value) != (*frame).end());
+        gen_lw(reg, (int32_t)(*frame)[value].offset, "sp");
+    }
+}
+
+/* Register holding `value`: its home, or else `reg` loaded with it */
+static std::string gen_value_reg(const std::string &reg, const koopa_raw_value_t &value){
+    std::string home = home_of(value);
+    if(!home.empty()){
+        return home;
+    }
+    gen_load_operand(reg, value);
+    return reg;
+}
+
+/* Operand -> register, with x0 for 0 */
+static std::string gen_operand_reg(const koopa_raw_value_t &value){
+    if(value->kind.tag == KOOPA_RVT_INTEGER && value->kind.data.integer.value == 0){
+        return "x0";
+    }
+    if(!home_of(value).empty()){
+        return home_of(value);
+    }
+    std::string reg = "t" + std::to_string(register_counter++);
+    gen_load_operand(reg, value);
+    return reg;
+}
+
+/* Where the result of `value` is computed: its home, or else `reg` */
+static std::string result_reg(const koopa_raw_value_t &value, const std::string &reg){
+    std::string home = home_of(value);
+    return home.empty() ? reg : home;
+}
+
+/* Result in `reg` -> the home or the slot of `value` */
+static void gen_store_result(const std::string &reg, const koopa_raw_value_t &value){
+    assert((*frame).find(value) != (*frame).end());
+    std::string home = home_of(value);
+    if(home.empty()){
+        assert(!is_early);
+        gen_sw(reg, (int32_t)(*frame)[value].offset, "sp");
+    }
+    else if(home != reg){
+        gen_mv(home, reg);
+    }
+}
+
+/* rd = rs * elem_size, with a shift for powers of two */
+static void gen_scale_index(const std::string &rd, const std::string &rs, size_t elem_size){
+    assert(elem_size > 0);
+    std::string rtemp = "t" + std::to_string(register_counter++);
+    if((elem_size & (elem_size - 1)) == 0){
+        int shift = 0;
+        while(1){
+            elem_size = elem_size >> 1;
+            if(elem_size == 0){
+                break;
+            }
+            shift += 1;
+        }
+        gen_li(rtemp, shift);
+        gen_sll(rd, rs, rtemp);
+    }
+    else{
+        gen_li(rtemp, elem_size);
+        gen_mul(rd, rs, rtemp);
+    }
+    --register_counter;
+}
+
+/*
+    `ptr` as `base` register + constant offset, ready for `lw`/`sw`.
+    Folded addresses (see `folded_addrs`) are computed here; registers are
+    taken from `register_counter` on and left for the caller to release.
+*/
+static int32_t gen_address(std::string &base, const koopa_raw_value_t &ptr){
+    if(ptr->kind.tag == KOOPA_RVT_ALLOC){
+        assert((*frame).find(ptr) != (*frame).end());
+        base = "sp";
+        return (int32_t)(*frame)[ptr].offset;
+    }
+    if(folded_addrs.count(ptr) == 0){
+        base = gen_value_reg("t" + std::to_string(register_counter++), ptr);
+        return 0;
+    }
+
+    koopa_raw_value_t src, index;
+    size_t elem_size;
+    if(ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR){
+        src = ptr->kind.data.get_elem_ptr.src;
+        index = ptr->kind.data.get_elem_ptr.index;
+        elem_size = size_of_type(src->ty->data.pointer.base->data.array.base);
+    }
+    else{
+        src = ptr->kind.data.get_ptr.src;
+        index = ptr->kind.data.get_ptr.index;
+        elem_size = size_of_type(src->ty->data.pointer.base);
+    }
+
+    int32_t offset = gen_address(base, src);
+    if(index->kind.tag == KOOPA_RVT_INTEGER){
+        return offset + index->kind.data.integer.value * (int32_t)elem_size;
+    }
+
+    std::string reg_index = "t" + std::to_string(register_counter++);
+    gen_scale_index(reg_index, gen_value_reg(reg_index, index), elem_size);
+    if(base[0] != 't'){
+        /* sp or a home: not ours to change */
+        gen_add(reg_index, base, reg_index);
+        base = reg_index;
+    }
+    else{
+        gen_add(base, base, reg_index);
+        --register_counter;
+    }
+    return offset;
+}
+
+/* A register, a slot `offset(sp)`, or (`value` set) a constant or address made on the spot */
+typedef struct{
+    std::string reg;
+    int32_t offset;
+    koopa_raw_value_t value;
+} location_t;
+
+typedef std::vector<std::pair<location_t, location_t> > move_list_t;    /* (dest, src) */
+
+static location_t location_of(const koopa_raw_value_t &value){
+    std::string home = home_of(value);
+    if(!home.empty()){
+        return {home, 0, nullptr};
+    }
+    auto it = (*frame).find(value);
+    if(it == (*frame).end() || value->kind.tag == KOOPA_RVT_ALLOC){
+        return {"", 0, value};
+    }
+    return {"", (int32_t)it->second.offset, nullptr};
+}
+
+static bool is_same_location(const location_t &a, const location_t &b){
+    return a.value == nullptr && b.value == nullptr
+        && a.reg == b.reg && (!a.reg.empty() || a.offset == b.offset);
+}
+
+/* Register holding what is at `loc`: its own, or `reg` loaded with it */
+static std::string gen_read_location(const std::string &reg, const location_t &loc){
+    if(loc.value != nullptr){
+        gen_load_operand(reg, loc.value);
+        return reg;
+    }
+    if(!loc.reg.empty()){
+        return loc.reg;
+    }
+    gen_lw(reg, loc.offset, "sp");
+    return reg;
+}
+
+static void gen_write_location(const location_t &loc, const std::string &reg){
+    if(loc.reg.empty()){
+        gen_sw(reg, loc.offset, "sp");
+    }
+    else if(loc.reg != reg){
+        gen_mv(loc.reg, reg);
+    }
+}
+
+/*
+    All the moves at once, between registers and slots. A location is
+    overwritten only after every pending move has read it; a cycle (e.g.
+    swapping two loop variables) is broken by keeping the old value of
+    one location in a register.
+*/
+static void gen_parallel_copy(const move_list_t &all_moves){
+    typedef struct{
+        location_t dest;
+        location_t src;
+        bool is_src_saved;
+    } move_t;
+
+    std::vector<move_t> moves;
+    for(auto &move : all_moves){
+        if(!is_same_location(move.first, move.second)){
+            moves.push_back({move.first, move.second, false});
+        }
+    }
+
+    std::string reg_value = "t" + std::to_string(register_counter++);
+    std::string reg_saved = "t" + std::to_string(register_counter++);
+    while(!moves.empty()){
+        size_t i;
+        for(i = 0; i < moves.size(); ++i){
+            bool is_read = false;
+            for(auto &move : moves){
+                if(!move.is_src_saved && is_same_location(move.src, moves[i].dest)){
+                    is_read = true;
+                    break;
+                }
+            }
+            if(!is_read){
+                break;
+            }
+        }
+
+        if(i == moves.size()){
+            /* Every dest is still needed: save the first one */
+            location_t loc = moves[0].dest;
+            gen_write_location({reg_saved, 0, nullptr}, gen_read_location(reg_saved, loc));
+            for(auto &move : moves){
+                if(is_same_location(move.src, loc)){
+                    move.is_src_saved = true;
+                }
+            }
+            continue;
+        }
+
+        const auto &dest = moves[i].dest;
+        if(moves[i].is_src_saved){
+            gen_write_location(dest, reg_saved);
         }
         else{
-            assert((*frame).find(ret.value) != (*frame).end());
-            size_t offset_ret = (*frame)[ret.value].offset;
-            gen_lw("a0", (int32_t)offset_ret, "sp");
+            std::string reg = dest.reg.empty() ? reg_value : dest.reg;
+            gen_write_location(dest, gen_read_location(reg, moves[i].src));
         }
+        moves.erase(moves.begin() + i);
+    }
+    register_counter -= 2;
+}
+
+/* Pass `args` to the params of `target` */
+static void gen_block_args(const koopa_raw_slice_t &args, const koopa_raw_basic_block_t &target){
+    assert(args.len == target->params.len);
+    move_list_t moves;
+    for(size_t i = 0; i < args.len; ++i){
+        auto param = reinterpret_cast<koopa_raw_value_t>(target->params.buffer[i]);
+        auto arg = reinterpret_cast<koopa_raw_value_t>(args.buffer[i]);
+        moves.push_back({location_of(param), location_of(arg)});
+    }
+    gen_parallel_copy(moves);
+}
+
+/* Slot of the k-th saved s register, below `ra` */
+static int32_t saved_reg_offset(size_t k){
+    size_t frame_size = map_frame2size[frame];
+    size_t below = map_frame2is_with_call[frame] ? 2 : 1;
+    return (int32_t)(frame_size - SIZE_INT32 * (k + below));
+}
+
+/* Set up the frame, then move the live values from their early homes */
+static void gen_prologue(){
+    const auto &wrap = map_frame2wrap[frame];
+    size_t frame_size = map_frame2size[frame];
+    if(frame_size > 0){
+        gen_addi("sp", "sp", -(int32_t)frame_size);
+    }
+    if(map_frame2is_with_call[frame]){
+        gen_sw("ra", (int32_t)(frame_size - 4), "sp");
+    }
+    for(size_t k = 0; k < wrap.saved_regs.size(); ++k){
+        gen_sw(wrap.saved_regs[k], saved_reg_offset(k), "sp");
+    }
+
+    move_list_t moves;
+    for(auto value : wrap.save_live_in){
+        moves.push_back({location_of(value), {(*frame)[value].early_reg, 0, nullptr}});
     }
+    gen_parallel_copy(moves);
+}
 
-    /* Epilogue */
+/* Restore what the prologue saved and pop the frame */
+static void gen_restore(){
+    const auto &wrap = map_frame2wrap[frame];
     size_t frame_size = map_frame2size[frame];
+    for(size_t k = 0; k < wrap.saved_regs.size(); ++k){
+        gen_lw(wrap.saved_regs[k], saved_reg_offset(k), "sp");
+    }
     if(map_frame2is_with_call[frame]){
         gen_lw("ra", (int32_t)(frame_size - 4), "sp");
     }
-    gen_addi("sp", "sp", (int32_t)frame_size);
+    if(frame_size > 0){
+        gen_addi("sp", "sp", (int32_t)frame_size);
+    }
+}
+
+void Visit(const koopa_raw_return_t &ret){
+    /* load return value if necessary */
+    if(ret.value != nullptr){
+        gen_load_operand("a0", ret.value);
+    }
+
+    /* Epilogue, unless the frame is not set up yet */
+    if(is_early || map_frame2wrap[frame].save_bb == nullptr){
+        gen_ret();
+        return;
+    }
+    if(!epilogue_label.empty()){
+        gen_j(epilogue_label);
+        return;
+    }
+    epilogue_label = "epilogue_" + std::to_string(epilogue_label_id++);
+    std::cout << epilogue_label << ":" << std::endl;
+    gen_restore();
     gen_ret();
 }
 
+/*
+    `var op literal`, or `literal op var`, with an I-type instruction
+    (addi, andi, ori, xori, slti) when the literal fits in 12 bits.
+    Comparisons with the literal first are turned around; `gt` is left to
+    `slt`, which is as short with the literal in a register.
+*/
+static bool gen_binary_imm(const koopa_raw_binary_t &binary, const std::string &reg){
+    bool is_lhs_imm = binary.lhs->kind.tag == KOOPA_RVT_INTEGER;
+    bool is_rhs_imm = binary.rhs->kind.tag == KOOPA_RVT_INTEGER;
+    if(is_lhs_imm == is_rhs_imm){
+        return false;
+    }
+    auto var = is_lhs_imm ? binary.rhs : binary.lhs;
+    int64_t imm = (is_lhs_imm ? binary.lhs : binary.rhs)->kind.data.integer.value;
+
+    koopa_raw_binary_op_t op = binary.op;
+    if(is_lhs_imm){
+        switch (op)
+        {
+        case KOOPA_RBO_GT: op = KOOPA_RBO_LT; break;
+        case KOOPA_RBO_LT: op = KOOPA_RBO_GT; break;
+        case KOOPA_RBO_GE: op = KOOPA_RBO_LE; break;
+        case KOOPA_RBO_LE: op = KOOPA_RBO_GE; break;
+        case KOOPA_RBO_SUB: return false;
+        default: break;
+        }
+    }
+
+    std::string i_op, then_op;
+    switch (op)
+    {
+    case KOOPA_RBO_ADD:
+        i_op = "addi";
+        break;
+    case KOOPA_RBO_SUB:
+        i_op = "addi";
+        imm = -imm;
+        break;
+    case KOOPA_RBO_AND:
+        i_op = "andi";
+        break;
+    case KOOPA_RBO_OR:
+        i_op = "ori";
+        break;
+    case KOOPA_RBO_XOR:
+        i_op = "xori";
+        break;
+    case KOOPA_RBO_LT:
+        i_op = "slti";
+        break;
+    case KOOPA_RBO_LE:
+        /* x <= imm is x < imm + 1 */
+        i_op = "slti";
+        imm += 1;
+        break;
+    case KOOPA_RBO_GE:
+        i_op = "slti";
+        then_op = "xori";
+        break;
+    case KOOPA_RBO_EQ:
+    case KOOPA_RBO_NOT_EQ:
+        if(imm == 0){
+            /* seqz / snez on its own */
+            return false;
+        }
+        i_op = "xori";
+        then_op = (op == KOOPA_RBO_EQ) ? "seqz" : "snez";
+        break;
+    default:
+        return false;
+    }
+    if(imm > IMM12_MAX || imm < IMM12_MIN){
+        return false;
+    }
+
+    std::string reg_var = gen_value_reg(reg, var);
+    std::cout << "\t" << i_op << "\t" << reg << ", " << reg_var << ", " << imm << std::endl;
+    if(then_op == "xori"){
+        std::cout << "\txori\t" << reg << ", " << reg << ", 1" << std::endl;
+    }
+    else if(!then_op.empty()){
+        std::cout << "\t" << then_op << "\t" << reg << ", " << reg << std::endl;
+    }
+    return true;
+}
+
 void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value){
     const koopa_raw_binary_op_t &op = binary.op;
     const koopa_raw_value_t &lhs = binary.lhs;
@@ -229,48 +689,55 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value){
 
     int register_counter_init = register_counter;
 
-    /*
-        TODO: this assertion is now wrong, due to the `ne 0,` operation when
-        dealing with short-circuit logic (land) in `ast.h`.
-    */
-    // assert(!(lhs->kind.tag == KOOPA_RVT_INTEGER &&
-    //         rhs->kind.tag == KOOPA_RVT_INTEGER));
-
-    if(lhs->kind.tag == KOOPA_RVT_INTEGER){
-        if(lhs->kind.data.integer.value == 0){
-            reg_lhs = "x0";
-        }
-        else{
-            reg_lhs = "t" + std::to_string(register_counter);
-            rd = "t" + std::to_string(register_counter++);
-            gen_li(rd, lhs->kind.data.integer.value);
-        }
-    }
-    else{
-        assert((*frame).find(lhs) != (*frame).end());
-        reg_lhs = "t" + std::to_string(register_counter++);
-        size_t offset_lhs = (*frame)[lhs].offset;
-        gen_lw(reg_lhs, (int32_t)offset_lhs, "sp");
+    if(fused_branch_conds.count(value)){
+        /* Done by the branch */
+        return;
     }
 
-    if(rhs->kind.tag == KOOPA_RVT_INTEGER){
-        if(rhs->kind.data.integer.value == 0){
-            reg_rhs = "x0";
+    /* By a constant: shifts or a magic-number `mulh` (see `gen_mul_imm`) */
+    bool is_mul_imm = (op == KOOPA_RBO_MUL)
+                        && (lhs->kind.tag == KOOPA_RVT_INTEGER) != (rhs->kind.tag == KOOPA_RVT_INTEGER);
+    bool is_div_imm = (op == KOOPA_RBO_DIV || op == KOOPA_RBO_MOD)
+                        && lhs->kind.tag != KOOPA_RVT_INTEGER && rhs->kind.tag == KOOPA_RVT_INTEGER;
+    if(is_mul_imm || is_div_imm){
+        auto var = (lhs->kind.tag == KOOPA_RVT_INTEGER) ? rhs : lhs;
+        int32_t imm = ((lhs->kind.tag == KOOPA_RVT_INTEGER) ? lhs : rhs)->kind.data.integer.value;
+        reg_result = result_reg(value, "t" + std::to_string(register_counter++));
+        std::string reg_var = gen_value_reg(reg_result, var);
+        if(op == KOOPA_RBO_MUL){
+            gen_mul_imm(reg_result, reg_var, imm);
+        }
+        else if(op == KOOPA_RBO_DIV){
+            gen_div_imm(reg_result, reg_var, imm);
         }
         else{
-            reg_rhs = "t" + std::to_string(register_counter);
-            rd = "t" + std::to_string(register_counter++);
-            gen_li(rd, rhs->kind.data.integer.value);
+            gen_rem_imm(reg_result, reg_var, imm);
         }
+
+        gen_store_result(reg_result, value);
+        register_counter = register_counter_init;
+        return;
     }
-    else{
-        assert((*frame).find(rhs) != (*frame).end());
-        reg_rhs = "t" + std::to_string(register_counter++);
-        size_t offset_rhs = (*frame)[rhs].offset;
-        gen_lw(reg_rhs, (int32_t)offset_rhs, "sp");
+
+    reg_result = result_reg(value, "t" + std::to_string(register_counter++));
+    if(gen_binary_imm(binary, reg_result)){
+        gen_store_result(reg_result, value);
+        register_counter = register_counter_init;
+        return;
     }
+    register_counter = register_counter_init;
+
+    /*
+        TODO: this assertion is now wrong, due to the `ne 0,` operation when
+        dealing with short-circuit logic (land) in `ast.h`.
+    */
+    // assert(!(lhs->kind.tag == KOOPA_RVT_INTEGER &&
+    //         rhs->kind.tag == KOOPA_RVT_INTEGER));
 
-    reg_result = "t" + std::to_string(register_counter_init);
+    reg_lhs = gen_operand_reg(lhs);
+    reg_rhs = gen_operand_reg(rhs);
+
+    reg_result = result_reg(value, "t" + std::to_string(register_counter_init));
 
     switch (op)
     {
@@ -360,15 +827,15 @@ void Visit(const koopa_raw_binary_t &binary, const koopa_raw_value_t &value){
         break;
     }
 
-    assert((*frame).find(value) != (*frame).end());
-    size_t offset_result = (*frame)[value].offset;
-    gen_sw(reg_result, offset_result, "sp");
+    gen_store_result(reg_result, value);
 
     register_counter = register_counter_init;
 }
 
 void Visit(const koopa_raw_store_t &store){
-    if(store.value->kind.tag == KOOPA_RVT_FUNC_ARG_REF){
+    if(store.value->kind.tag == KOOPA_RVT_FUNC_ARG_REF
+        && store.dest->kind.tag == KOOPA_RVT_ALLOC
+        && (*frame).find(store.value) == (*frame).end()){
         size_t idx = store.value->kind.data.func_arg_ref.index;
         if(idx < 8){
             size_t offset_dest = (*frame)[store.dest].offset;
@@ -390,119 +857,118 @@ void Visit(const koopa_raw_store_t &store){
     else{
         int register_counter_original = register_counter;
 
-        if(store.value->kind.tag == KOOPA_RVT_INTEGER){
-            rd = "t" + std::to_string(register_counter++);
-            gen_li(rd, store.value->kind.data.integer.value);
-        }
-        else{
+        rs2 = gen_operand_reg(store.value);
 
-// std::cerr << store.value->kind.tag << "," << store.value->name  << "," << store.value->ty->tag << "\n";
+        std::string base;
+        int32_t offset = gen_address(base, store.dest);
+        gen_sw(rs2, offset, base);
 
-            assert((*frame).find(store.value) != (*frame).end());
-            size_t offset_src = (*frame)[store.value].offset;
-            rs = "t" + std::to_string(register_counter++);
-            gen_lw(rs, offset_src, "sp");
-        }
-
-        if(store.dest->kind.tag == KOOPA_RVT_GLOBAL_ALLOC){
-            rd = "t" + std::to_string(register_counter++);
-            gen_la(rd, globl2name[store.dest]);
+        register_counter = register_counter_original;
+    }
+}
 
-            rs2 = "t" + std::to_string(register_counter - 2);
-            rs1 = "t" + std::to_string(register_counter - 1);
-            gen_sw(rs2, 0, rs1);
-        }
-        else if(store.dest->kind.tag == KOOPA_RVT_GET_ELEM_PTR){
-            assert((*frame).find(store.dest) != (*frame).end());
-            size_t offset_dest = (*frame)[store.dest].offset;
+void Visit(const koopa_raw_load_t &load, const koopa_raw_value_t &value){
+    int register_counter_original = register_counter;
 
-            rs = "t" + std::to_string(register_counter++);
-            gen_lw(rs, (int32_t)offset_dest, "sp");
+    std::string base;
+    int32_t offset = gen_address(base, load.src);
+    rd = result_reg(value, "t" + std::to_string(register_counter++));
+    gen_lw(rd, offset, base);
+    gen_store_result(rd, value);
 
-            rs2 = "t" + std::to_string(register_counter - 2);
-            rs1 = "t" + std::to_string(register_counter - 1);
-            gen_sw(rs2, 0, rs1);
-        }
-        else if(store.dest->kind.tag == KOOPA_RVT_GET_PTR){
-            assert((*frame).find(store.dest) != (*frame).end());
-            size_t offset_dest = (*frame)[store.dest].offset;
+    register_counter = register_counter_original;
+}
 
-            rs = "t" + std::to_string(register_counter++);
-            gen_lw(rs, (int32_t)offset_dest, "sp");
+/* Jump to `label` if `cond` is (`is_true`) or is not (`!is_true`) zero */
+static void gen_cond_branch(const koopa_raw_value_t &cond, bool is_true,
+        const std::string &label){
+    int register_counter_init = register_counter;
 
-            rs2 = "t" + std::to_string(register_counter - 2);
-            rs1 = "t" + std::to_string(register_counter - 1);
-            gen_sw(rs2, 0, rs1);
+    if(fused_branch_conds.count(cond) == 0){
+        rd = gen_operand_reg(cond);
+        if(is_true){
+            gen_bnez(rd, label);
         }
         else{
-            assert((*frame).find(store.dest) != (*frame).end());
-            size_t offset_dest = (*frame)[store.dest].offset;
-
-            rs2 = "t" + std::to_string(register_counter - 1);
-            gen_sw(rs2, (int32_t)offset_dest, "sp");
+            gen_beqz(rd, label);
         }
-
-        register_counter = register_counter_original;
+        register_counter = register_counter_init;
+        return;
     }
-}
-
-void Visit(const koopa_raw_load_t &load, const koopa_raw_value_t &value){
 
-// std::cerr << "?" <<    load.src->kind.tag << "\n";
-
-    if(load.src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC){
-        rd = "t" + std::to_string(register_counter++);
-        gen_la(rd, globl2name[load.src]);
-        gen_lw(rd, 0, rd);
-    }
-    else if(load.src->kind.tag == KOOPA_RVT_GET_ELEM_PTR){
-        assert((*frame).find(load.src) != (*frame).end());
-        size_t offset_src = (*frame)[load.src].offset;
-        rs = "t" + std::to_string(register_counter++);
-        gen_lw(rs, (int32_t)offset_src, "sp");
-        gen_lw(rs, 0, rs);
-    }
-    else if(load.src->kind.tag == KOOPA_RVT_GET_PTR){
-        assert((*frame).find(load.src) != (*frame).end());
-        size_t offset_src = (*frame)[load.src].offset;
-        rs = "t" + std::to_string(register_counter++);
-        gen_lw(rs, (int32_t)offset_src, "sp");
-        gen_lw(rs, 0, rs);
-    }
-    else{
-        assert((*frame).find(load.src) != (*frame).end());
-        size_t offset_src = (*frame)[load.src].offset;
-        rs = "t" + std::to_string(register_counter++);
-        gen_lw(rs, (int32_t)offset_src, "sp");
+    /* Compare and branch; GT and LE swap the operands */
+    const koopa_raw_binary_t &binary = cond->kind.data.binary;
+    std::string reg_lhs = gen_operand_reg(binary.lhs);
+    std::string reg_rhs = gen_operand_reg(binary.rhs);
+    std::string op;
+    switch (binary.op)
+    {
+    case KOOPA_RBO_NOT_EQ:
+        op = is_true ? "bne" : "beq";
+        break;
+    case KOOPA_RBO_EQ:
+        op = is_true ? "beq" : "bne";
+        break;
+    case KOOPA_RBO_LT:
+        op = is_true ? "blt" : "bge";
+        break;
+    case KOOPA_RBO_GE:
+        op = is_true ? "bge" : "blt";
+        break;
+    case KOOPA_RBO_GT:
+        op = is_true ? "blt" : "bge";
+        std::swap(reg_lhs, reg_rhs);
+        break;
+    case KOOPA_RBO_LE:
+        op = is_true ? "bge" : "blt";
+        std::swap(reg_lhs, reg_rhs);
+        break;
+    default:
+        assert(false);
+        break;
     }
-
-    assert((*frame).find(value) != (*frame).end());
-    size_t offset_dest = (*frame)[value].offset;
-    rs2 = "t" + std::to_string(register_counter - 1);
-    gen_sw(rs2, (int32_t)offset_dest, "sp");
-    --register_counter;
+    gen_branch(op, reg_lhs, reg_rhs, label);
+    register_counter = register_counter_init;
 }
 
 void Visit(const koopa_raw_branch_t &branch){
-    if(branch.cond->kind.tag == KOOPA_RVT_INTEGER){
-        rd = "t" + std::to_string(register_counter++);
-        gen_li(rd, branch.cond->kind.data.integer.value);
-        gen_bnez(rd, branch.true_bb->name + 1);
+    /*
+        Branch straight to the target whose edge has no args to copy,
+        preferably so that the other edge falls through
+    */
+    if(branch.true_args.len == 0
+        && !(branch.true_bb == next_bb && branch.false_args.len == 0)){
+        gen_cond_branch(branch.cond, true, branch.true_bb->name + 1);
+        gen_block_args(branch.false_args, branch.false_bb);
+        if(branch.false_bb != next_bb){
+            gen_j(branch.false_bb->name + 1);
+        }
+        return;
     }
-    else{
-        assert((*frame).find(branch.cond) != (*frame).end());
-        size_t offset_cond = (*frame)[branch.cond].offset;
-
-        rs = "t" + std::to_string(register_counter++);
-        gen_lw(rs, (int32_t)offset_cond, "sp");
-        gen_bnez(rs, branch.true_bb->name + 1);
+    if(branch.false_args.len == 0){
+        gen_cond_branch(branch.cond, false, branch.false_bb->name + 1);
+        gen_block_args(branch.true_args, branch.true_bb);
+        if(branch.true_bb != next_bb){
+            gen_j(branch.true_bb->name + 1);
+        }
+        return;
     }
+
+    /* Both edges copy args: the true edge does it out of line */
+    std::string label_true = "edge_" + std::to_string(edge_label_id++);
+    gen_cond_branch(branch.cond, true, label_true);
+    gen_block_args(branch.false_args, branch.false_bb);
     gen_j(branch.false_bb->name + 1);
-    --register_counter;
+    std::cout << label_true << ":" << std::endl;
+    gen_block_args(branch.true_args, branch.true_bb);
+    gen_j(branch.true_bb->name + 1);
 }
 
 void Visit(const koopa_raw_jump_t &jump){
-    gen_j(jump.target->name + 1);
+    gen_block_args(jump.args, jump.target);
+    if(jump.target != next_bb){
+        gen_j(jump.target->name + 1);
+    }
 }
 
 void Visit(const koopa_raw_call_t &call, const koopa_raw_value_t &value){
@@ -510,46 +976,31 @@ void Visit(const koopa_raw_call_t &call, const koopa_raw_value_t &value){
 
     assert(call.args.kind == KOOPA_RSIK_VALUE);
     len = call.args.len;
-    for(idx = 0; idx < len; ++idx){
+    /* Stack args first, while a0-a7 still hold what they are read from */
+    for(idx = 8; idx < len; ++idx){
         auto param = reinterpret_cast<koopa_raw_value_t>(call.args.buffer[idx]);
-        if(idx < 8){
-            if(param->kind.tag == KOOPA_RVT_INTEGER){
-                /* TODO: save the previous value in a[0-7]? */
-                rd = "a" + std::to_string(idx);
-                gen_li(rd, param->kind.data.integer.value);
-            }
-            else{
-                assert((*frame).find(param) != (*frame).end());
-                size_t offset_param = (*frame)[param].offset;
-                rs = "a" + std::to_string(idx);
-                gen_lw(rs, (int32_t)offset_param, "sp");
-            }
-        }
-        else{
-            if(param->kind.tag == KOOPA_RVT_INTEGER){
-                rd = "t" + std::to_string(register_counter++);
-                gen_li(rd, param->kind.data.integer.value);
-                size_t offset_dest = (idx - 8) * 4;
-                gen_sw(rd, (int32_t)offset_dest, "sp");
-                --register_counter;
-            }
-            else{
-                assert((*frame).find(param) != (*frame).end());
-                size_t offset_param = (*frame)[param].offset;
-                rs = "t" + std::to_string(register_counter++);
-                gen_lw(rs, (int32_t)offset_param, "sp");
-                size_t offset_dest = (idx - 8) * 4;
-                gen_sw(rs, (int32_t)offset_dest, "sp");
-                --register_counter;
-            }
-        }
+        rs = gen_value_reg("t" + std::to_string(register_counter++), param);
+        size_t offset_dest = (idx - 8) * 4;
+        gen_sw(rs, (int32_t)offset_dest, "sp");
+        --register_counter;
+    }
+    move_list_t moves;
+    for(idx = 0; idx < len && idx < 8; ++idx){
+        auto param = reinterpret_cast<koopa_raw_value_t>(call.args.buffer[idx]);
+        moves.push_back({{"a" + std::to_string(idx), 0, nullptr}, location_of(param)});
+    }
+    gen_parallel_copy(moves);
+    if(tail_calls.count(value)){
+        /* Epilogue, then jump; the callee returns to our caller */
+        gen_restore();
+        gen_tail(call.callee->name + 1);
+        return;
     }
     gen_call(call.callee->name + 1);
 
-    if(value->ty->tag != KOOPA_RTT_UNIT){
-        assert((*frame).find(value) != (*frame).end());
-        size_t offset_dest = (*frame)[value].offset;
-        gen_sw("a0", (int32_t)offset_dest, "sp");
+    if(value->ty->tag != KOOPA_RTT_UNIT
+        && (*frame).find(value) != (*frame).end()){
+        gen_store_result("a0", value);
     }
 }
 
@@ -565,138 +1016,44 @@ void Visit(const koopa_raw_global_alloc_t &globl_alloc, const koopa_raw_value_t
     riscv_gen_initializer(globl_alloc.init);
 }
 
-void Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr, const koopa_raw_value_t &value){
-    if(get_elem_ptr.src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC){
-        rd = "t" + std::to_string(register_counter++);
-        gen_la(rd, globl2name[get_elem_ptr.src]);
-        // gen_lw(rd, 0, rd);
-    }
-    else if(get_elem_ptr.src->kind.tag == KOOPA_RVT_GET_ELEM_PTR){
-        rs = "t" + std::to_string(register_counter++);
-        size_t offset_src = (*frame)[get_elem_ptr.src].offset;
-        gen_lw(rs, (int32_t)offset_src, "sp");
-    }
-    else if(get_elem_ptr.src->kind.tag == KOOPA_RVT_GET_PTR){
-        rs = "t" + std::to_string(register_counter++);
-        size_t offset_src = (*frame)[get_elem_ptr.src].offset;
-        gen_lw(rs, (int32_t)offset_src, "sp");
-    }
-    else{
-        assert((*frame).find(get_elem_ptr.src) != (*frame).end());
-        size_t offset_base = (*frame)[get_elem_ptr.src].offset;
-        rd = "t" + std::to_string(register_counter++);
-        gen_addi(rd, "sp", (int32_t)offset_base);
-    }
+/* value = src + index * elem_size; a constant index is a single `addi` */
+static void gen_pointer_arith(const koopa_raw_value_t &src, const koopa_raw_value_t &index,
+                              size_t elem_size, const koopa_raw_value_t &value){
+    int register_counter_init = register_counter;
+    rd = result_reg(value, "t" + std::to_string(register_counter++));
 
-    if(get_elem_ptr.index->kind.tag == KOOPA_RVT_INTEGER){
-        rd = "t" + std::to_string(register_counter++);
-        gen_li(rd, get_elem_ptr.index->kind.data.integer.value);
+    if(index->kind.tag == KOOPA_RVT_INTEGER){
+        int32_t offset = index->kind.data.integer.value * (int32_t)elem_size;
+        gen_addi(rd, gen_value_reg(rd, src), offset);
     }
     else{
-        assert((*frame).find(get_elem_ptr.index) != (*frame).end());
-        size_t offset_idx = (*frame)[get_elem_ptr.index].offset;
+        /* the index first: `rd` may be its home */
         rs = "t" + std::to_string(register_counter++);
-        gen_lw(rs, (int32_t)offset_idx, "sp");
+        gen_scale_index(rs, gen_value_reg(rs, index), elem_size);
+        gen_add(rd, gen_value_reg(rd, src), rs);
     }
 
-    assert(get_elem_ptr.src->ty->data.pointer.base->tag == KOOPA_RTT_ARRAY);
-    size_t elem_size = size_of_type(get_elem_ptr.src->ty->data.pointer.base->data.array.base);
-    assert(elem_size > 0);
+    gen_store_result(rd, value);
+    register_counter = register_counter_init;
+}
 
-    if((elem_size & (elem_size - 1)) == 0){
-        int shift = 0;
-        while(1){
-            elem_size = elem_size >> 1;
-            if(elem_size == 0){
-                break;
-            }
-            shift += 1;
-        }
-        rd = "t" + std::to_string(register_counter++);
-        gen_li(rd, shift);
-        rs1 = "t" + std::to_string(register_counter - 2);
-        gen_sll(rs1, rs1, rd);
-        --register_counter;
-    }
-    else{
-        rd = "t" + std::to_string(register_counter++);
-        gen_li(rd, elem_size);
-        rs1 = "t" + std::to_string(register_counter - 2);
-        gen_mul(rs1, rs1, rd);
-        --register_counter;
+void Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr, const koopa_raw_value_t &value){
+    if(folded_addrs.count(value)){
+        /* computed by each load / store using it */
+        return;
     }
-
-    rs1 = "t" + std::to_string(register_counter - 2);
-    rs2 = "t" + std::to_string(register_counter - 1);
-    gen_add(rs1, rs1, rs2);
-    --register_counter;
-
-    assert((*frame).find(value) != (*frame).end());
-    size_t offset_dest = (*frame)[value].offset;
-    rs2 = "t" + std::to_string(register_counter - 1);
-    gen_sw(rs2, (int32_t)offset_dest, "sp");
-    --register_counter;
+    assert(get_elem_ptr.src->ty->data.pointer.base->tag == KOOPA_RTT_ARRAY);
+    size_t elem_size = size_of_type(get_elem_ptr.src->ty->data.pointer.base->data.array.base);
+    gen_pointer_arith(get_elem_ptr.src, get_elem_ptr.index, elem_size, value);
 }
 
 void Visit(const koopa_raw_get_ptr_t &get_ptr, const koopa_raw_value_t &value){
-    if(get_ptr.src->kind.tag != KOOPA_RVT_LOAD){
-        // std::cerr << "error; src RVT:" << get_ptr.src->kind.tag << "\n";
-        assert(false);
-    }
-
-    assert((*frame).find(get_ptr.src) != (*frame).end());
-    size_t offset_base = (*frame)[get_ptr.src].offset;
-    rd = "t" + std::to_string(register_counter++);
-    // gen_addi(rd, "sp", (int32_t)offset_base);
-    gen_lw(rd, (int32_t)offset_base, "sp");
-
-    if(get_ptr.index->kind.tag == KOOPA_RVT_INTEGER){
-        rd = "t" + std::to_string(register_counter++);
-        gen_li(rd, get_ptr.index->kind.data.integer.value);
-    }
-    else{
-        assert((*frame).find(get_ptr.index) != (*frame).end());
-        size_t offset_idx = (*frame)[get_ptr.index].offset;
-        rs = "t" + std::to_string(register_counter++);
-        gen_lw(rs, (int32_t)offset_idx, "sp");
+    if(folded_addrs.count(value)){
+        return;
     }
-
+    /* Pointer from `load` (array param), or a param / block arg after mem2reg */
     size_t elem_size = size_of_type(get_ptr.src->ty->data.pointer.base);
-    assert(elem_size > 0);
-
-    if((elem_size & (elem_size - 1)) == 0){
-        int shift = 0;
-        while(1){
-            elem_size = elem_size >> 1;
-            if(elem_size == 0){
-                break;
-            }
-            shift += 1;
-        }
-        rd = "t" + std::to_string(register_counter++);
-        gen_li(rd, shift);
-        rs1 = "t" + std::to_string(register_counter - 2);
-        gen_sll(rs1, rs1, rd);
-        --register_counter;
-    }
-    else{
-        rd = "t" + std::to_string(register_counter++);
-        gen_li(rd, elem_size);
-        rs1 = "t" + std::to_string(register_counter - 2);
-        gen_mul(rs1, rs1, rd);
-        --register_counter;
-    }
-
-    rs1 = "t" + std::to_string(register_counter - 2);
-    rs2 = "t" + std::to_string(register_counter - 1);
-    gen_add(rs1, rs1, rs2);
-    --register_counter;
-
-    assert((*frame).find(value) != (*frame).end());
-    size_t offset_dest = (*frame)[value].offset;
-    rs2 = "t" + std::to_string(register_counter - 1);
-    gen_sw(rs2, (int32_t)offset_dest, "sp");
-    --register_counter;
+    gen_pointer_arith(get_ptr.src, get_ptr.index, elem_size, value);
 }
 
 /*
@@ -3,6 +3,7 @@
 
 #include "koopa.h"
 
-void libkoopa_string2rawprog2riscv(const char *str);
+void libkoopa_string2rawprog2riscv(const char *str, bool optimize);
+void libkoopa_string2alias_dump(const char *str);
 
 #endif /**< src/koopair.h */
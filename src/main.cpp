@@ -25,6 +25,7 @@ typedef enum{
     CMODE_KOOPA,
     CMODE_RISCV,
     CMODE_PERF,
+    CMODE_ALIAS,
 } cmode_t;
 
 int main(int argc, const char *argv[]) {
@@ -46,6 +47,9 @@ int main(int argc, const char *argv[]) {
     else if(strcmp(mode, "-perf") == 0){
         cmode = CMODE_PERF;
     }
+    else if(strcmp(mode, "-alias") == 0){
+        cmode = CMODE_ALIAS;
+    }
     else{
         assert(false);
     }
@@ -82,7 +86,14 @@ int main(int argc, const char *argv[]) {
     if(cmode == CMODE_RISCV || cmode == CMODE_PERF){
         ofstream fout(output);
         streambuf* old_buffer = cout.rdbuf(fout.rdbuf());
-        libkoopa_string2rawprog2riscv(string_koopair.c_str());
+        libkoopa_string2rawprog2riscv(string_koopair.c_str(), cmode == CMODE_PERF);
+        cout.rdbuf(old_buffer);
+    }
+    else
+    if(cmode == CMODE_ALIAS){
+        ofstream fout(output);
+        streambuf* old_buffer = cout.rdbuf(fout.rdbuf());
+        libkoopa_string2alias_dump(string_koopair.c_str());
         cout.rdbuf(old_buffer);
     }
 
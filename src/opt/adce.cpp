@@ -0,0 +1,98 @@
+#include "opt.h"
+#include "ir.h"
+
+#include <set>
+
+/*
+    Aggressive dead code elimination.
+
+    Everything is dead until proven live: stores, calls and terminators are
+    live by themselves, and a live instruction makes its operands live.
+    Arguments passed along an edge are only live when the block parameter
+    they feed is, so values that just circulate around a loop through
+    block params go away as well.
+*/
+
+typedef struct{
+    std::set<koopa_raw_value_t> live;
+    std::vector<koopa_raw_value_t> worklist;
+    /* block param -> the args passed to it on every incoming edge */
+    std::map<koopa_raw_value_t, std::vector<koopa_raw_value_t> > param_args;
+} adce_t;
+
+static void mark_live(adce_t &a, koopa_raw_value_t value){
+    if(value->kind.tag == KOOPA_RVT_INTEGER){
+        return;
+    }
+    if(a.live.insert(value).second){
+        a.worklist.push_back(value);
+    }
+}
+
+static void collect_param_args(adce_t &a, koopa_raw_basic_block_t target,
+        const koopa_raw_slice_t &args){
+    auto params = ir_values(target->params);
+    auto values = ir_values(args);
+    for(size_t i = 0; i < params.size(); ++i){
+        a.param_args[params[i]].push_back(values[i]);
+    }
+}
+
+void opt_adce(const koopa_raw_function_t &func){
+    ir_remove_unreachable_blocks(func);
+
+    adce_t a;
+    for(auto bb : ir_basic_blocks(func)){
+        for(auto inst : ir_values(bb->insts)){
+            if(ir_has_side_effect(inst)){
+                mark_live(a, inst);
+            }
+        }
+        auto &kind = ir_terminator(bb)->kind;
+        if(kind.tag == KOOPA_RVT_JUMP){
+            collect_param_args(a, kind.data.jump.target, kind.data.jump.args);
+        }
+        else if(kind.tag == KOOPA_RVT_BRANCH){
+            collect_param_args(a, kind.data.branch.true_bb, kind.data.branch.true_args);
+            collect_param_args(a, kind.data.branch.false_bb, kind.data.branch.false_args);
+        }
+    }
+
+    while(!a.worklist.empty()){
+        auto value = a.worklist.back();
+        a.worklist.pop_back();
+        if(value->kind.tag == KOOPA_RVT_BLOCK_ARG_REF){
+            for(auto arg : a.param_args[value]){
+                mark_live(a, arg);
+            }
+        }
+        else if(value->kind.tag == KOOPA_RVT_JUMP){
+            /* args are handled through the params */
+        }
+        else if(value->kind.tag == KOOPA_RVT_BRANCH){
+            mark_live(a, value->kind.data.branch.cond);
+        }
+        else{
+            for(auto operand : ir_operands(value)){
+                mark_live(a, operand);
+            }
+        }
+    }
+
+    for(auto bb : ir_basic_blocks(func)){
+        std::vector<koopa_raw_value_t> insts;
+        for(auto inst : ir_values(bb->insts)){
+            if(a.live.count(inst)){
+                insts.push_back(inst);
+            }
+        }
+        ir_set_insts(bb, insts);
+
+        auto params = ir_values(bb->params);
+        for(size_t i = params.size(); i-- > 0;){
+            if(a.live.count(params[i]) == 0){
+                ir_remove_block_param(func, bb, i);
+            }
+        }
+    }
+}
@@ -0,0 +1,563 @@
+#include "alias.h"
+#include "ir.h"
+#include "frame.h"
+
+#include <iostream>
+#include <string>
+
+/* One getelemptr / getptr on the way from the base object to a pointer */
+typedef struct{
+    bool is_elem;           /* getelemptr, else getptr */
+    koopa_raw_value_t index;
+    int64_t elem_size;
+} access_step_t;
+
+typedef std::map<koopa_raw_value_t, int64_t> affine_terms_t;
+
+static bool is_object(koopa_raw_value_t base){
+    return base->kind.tag == KOOPA_RVT_ALLOC || base->kind.tag == KOOPA_RVT_GLOBAL_ALLOC;
+}
+
+koopa_raw_value_t alias_base_object(koopa_raw_value_t ptr){
+    while(true){
+        if(ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR){
+            ptr = ptr->kind.data.get_elem_ptr.src;
+        }
+        else if(ptr->kind.tag == KOOPA_RVT_GET_PTR){
+            ptr = ptr->kind.data.get_ptr.src;
+        }
+        else{
+            return ptr;
+        }
+    }
+}
+
+/* The steps from the base object to `ptr`, the outermost first */
+static std::vector<access_step_t> access_path(koopa_raw_value_t ptr){
+    std::vector<access_step_t> steps;
+    while(true){
+        if(ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR){
+            auto src = ptr->kind.data.get_elem_ptr.src;
+            steps.push_back({true, ptr->kind.data.get_elem_ptr.index,
+                (int64_t)size_of_type(src->ty->data.pointer.base->data.array.base)});
+            ptr = src;
+        }
+        else if(ptr->kind.tag == KOOPA_RVT_GET_PTR){
+            auto src = ptr->kind.data.get_ptr.src;
+            steps.push_back({false, ptr->kind.data.get_ptr.index,
+                (int64_t)size_of_type(src->ty->data.pointer.base)});
+            ptr = src;
+        }
+        else{
+            return std::vector<access_step_t>(steps.rbegin(), steps.rend());
+        }
+    }
+}
+
+/* `a - b`, if it is a known constant */
+static bool index_difference(koopa_raw_value_t a, koopa_raw_value_t b, int64_t &diff){
+    int32_t offset_a, offset_b;
+    auto base_a = ir_split_offset(a, offset_a);
+    auto base_b = ir_split_offset(b, offset_b);
+    if(ir_is_integer(base_a) && ir_is_integer(base_b)){
+        diff = (int64_t)base_a->kind.data.integer.value + offset_a
+            - base_b->kind.data.integer.value - offset_b;
+        return true;
+    }
+    if(base_a == base_b){
+        diff = (int64_t)offset_a - offset_b;
+        return true;
+    }
+    return false;
+}
+
+/* Byte offset of a path as `sum(terms[v] * v) + constant` */
+static int64_t affine_offset(const std::vector<access_step_t> &steps, affine_terms_t &terms){
+    int64_t constant = 0;
+    for(auto &step : steps){
+        int32_t offset;
+        auto base = ir_split_offset(step.index, offset);
+        constant += step.elem_size * offset;
+        if(ir_is_integer(base)){
+            constant += step.elem_size * base->kind.data.integer.value;
+        }
+        else if((terms[base] += step.elem_size) == 0){
+            terms.erase(base);
+        }
+    }
+    return constant;
+}
+
+/* Only getelemptr after `from`: the pointer stays inside the element picked there */
+static bool stays_inside(const std::vector<access_step_t> &steps, size_t from){
+    for(size_t i = from + 1; i < steps.size(); ++i){
+        if(!steps[i].is_elem){
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Two paths from the same object */
+static bool paths_may_overlap(const std::vector<access_step_t> &a, const std::vector<access_step_t> &b){
+    for(size_t i = 0; i < a.size() && i < b.size(); ++i){
+        int64_t diff;
+        if(a[i].is_elem != b[i].is_elem || !index_difference(a[i].index, b[i].index, diff)){
+            break;
+        }
+        if(diff != 0){
+            if(stays_inside(a, i) && stays_inside(b, i)){
+                /* distinct elements of the same type */
+                return false;
+            }
+            break;
+        }
+        if(i + 1 == a.size() && i + 1 == b.size()){
+            return true;
+        }
+    }
+
+    /* accesses are i32 (4 bytes) at multiples of 4 */
+    affine_terms_t terms_a, terms_b;
+    int64_t constant_a = affine_offset(a, terms_a);
+    int64_t constant_b = affine_offset(b, terms_b);
+    return terms_a != terms_b || constant_a == constant_b;
+}
+
+static bool bases_may_overlap(const alias_info_t &info, koopa_raw_value_t base_a,
+        koopa_raw_value_t base_b){
+    if(base_a == base_b){
+        return true;
+    }
+    if(is_object(base_a) && is_object(base_b)){
+        return false;
+    }
+    if(base_b->kind.tag == KOOPA_RVT_ALLOC){
+        std::swap(base_a, base_b);
+    }
+    if(base_a->kind.tag == KOOPA_RVT_ALLOC){
+        /* a local and a pointer from outside */
+        return base_b->kind.tag != KOOPA_RVT_FUNC_ARG_REF && info.escaped.count(base_a);
+    }
+    return true;
+}
+
+static void add_escape(alias_info_t &info, koopa_raw_value_t value){
+    if(value != nullptr && value->ty->tag == KOOPA_RTT_POINTER){
+        auto base = alias_base_object(value);
+        if(base->kind.tag == KOOPA_RVT_ALLOC){
+            info.escaped.insert(base);
+        }
+    }
+}
+
+void alias_analyze(const koopa_raw_function_t &func, alias_info_t &info){
+    info.escaped.clear();
+    for(auto bb : ir_basic_blocks(func)){
+        for(auto inst : ir_values(bb->insts)){
+            const auto &kind = inst->kind;
+            switch (kind.tag)
+            {
+            case KOOPA_RVT_CALL:
+            case KOOPA_RVT_BRANCH:
+            case KOOPA_RVT_JUMP:
+                for(auto operand : ir_operands(inst)){
+                    add_escape(info, operand);
+                }
+                break;
+            case KOOPA_RVT_STORE:
+                add_escape(info, kind.data.store.value);
+                break;
+            case KOOPA_RVT_RETURN:
+                add_escape(info, kind.data.ret.value);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+bool alias_may_share_object(const alias_info_t &info, koopa_raw_value_t a, koopa_raw_value_t b){
+    return bases_may_overlap(info, alias_base_object(a), alias_base_object(b));
+}
+
+bool alias_must_alias(koopa_raw_value_t a, koopa_raw_value_t b){
+    if(a == b){
+        return true;
+    }
+    if(alias_base_object(a) != alias_base_object(b)){
+        return false;
+    }
+    auto path_a = access_path(a);
+    auto path_b = access_path(b);
+    if(path_a.size() != path_b.size()){
+        return false;
+    }
+    for(size_t i = 0; i < path_a.size(); ++i){
+        int64_t diff;
+        if(path_a[i].is_elem != path_b[i].is_elem
+            || !index_difference(path_a[i].index, path_b[i].index, diff) || diff != 0){
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<koopa_raw_value_t> alias_path_values(koopa_raw_value_t ptr){
+    std::vector<koopa_raw_value_t> values = {alias_base_object(ptr)};
+    for(auto &step : access_path(ptr)){
+        int32_t offset;
+        auto base = ir_split_offset(step.index, offset);
+        if(!ir_is_integer(base)){
+            values.push_back(base);
+        }
+    }
+    return values;
+}
+
+bool alias_may_alias(const alias_info_t &info, koopa_raw_value_t a, koopa_raw_value_t b){
+    if(a == b){
+        return true;
+    }
+    auto base_a = alias_base_object(a);
+    auto base_b = alias_base_object(b);
+    if(base_a != base_b){
+        return bases_may_overlap(info, base_a, base_b);
+    }
+    return paths_may_overlap(access_path(a), access_path(b));
+}
+
+/* Adds to `globals` / `through_args` an access through `ptr`; true if they grew */
+static bool add_access(std::set<koopa_raw_value_t> &globals, bool &through_args,
+        koopa_raw_value_t ptr){
+    auto base = alias_base_object(ptr);
+    if(base->kind.tag == KOOPA_RVT_GLOBAL_ALLOC){
+        return globals.insert(base).second;
+    }
+    if(base->kind.tag == KOOPA_RVT_ALLOC || through_args){
+        return false;
+    }
+    through_args = true;
+    return true;
+}
+
+/* Adds the accesses of a call to `callee` passing `args` */
+static bool add_call(std::set<koopa_raw_value_t> &globals, bool &through_args,
+        const std::set<koopa_raw_value_t> &callee_globals, bool callee_through_args,
+        const std::vector<koopa_raw_value_t> &args){
+    bool changed = false;
+    for(auto global : callee_globals){
+        changed |= globals.insert(global).second;
+    }
+    if(callee_through_args){
+        for(auto arg : args){
+            if(arg->ty->tag == KOOPA_RTT_POINTER){
+                changed |= add_access(globals, through_args, arg);
+            }
+        }
+    }
+    return changed;
+}
+
+void alias_call_summaries(const koopa_raw_program_t &program, call_summaries_t &summaries){
+    std::vector<koopa_raw_function_t> funcs;
+    for(size_t i = 0; i < program.funcs.len; ++i){
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        funcs.push_back(func);
+        bool is_library = (func->bbs.len == 0);
+        summaries[func] = {{}, {}, is_library, is_library};
+    }
+
+    /* summaries only grow; go on until none does */
+    bool changed = true;
+    while(changed){
+        changed = false;
+        for(auto func : funcs){
+            auto &summary = summaries[func];
+            for(auto bb : ir_basic_blocks(func)){
+                for(auto inst : ir_values(bb->insts)){
+                    if(inst->kind.tag == KOOPA_RVT_STORE){
+                        changed |= add_access(summary.mod_globals, summary.mod_args,
+                            inst->kind.data.store.dest);
+                    }
+                    else if(inst->kind.tag == KOOPA_RVT_LOAD){
+                        changed |= add_access(summary.ref_globals, summary.ref_args,
+                            inst->kind.data.load.src);
+                    }
+                    else if(inst->kind.tag == KOOPA_RVT_CALL){
+                        const auto &callee = summaries[inst->kind.data.call.callee];
+                        auto args = ir_values(inst->kind.data.call.args);
+                        changed |= add_call(summary.mod_globals, summary.mod_args,
+                            callee.mod_globals, callee.mod_args, args);
+                        changed |= add_call(summary.ref_globals, summary.ref_args,
+                            callee.ref_globals, callee.ref_args, args);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static bool call_may_access(const alias_info_t &info, const std::set<koopa_raw_value_t> &globals,
+        bool through_args, koopa_raw_value_t call, koopa_raw_value_t ptr){
+    auto base = alias_base_object(ptr);
+    if(base->kind.tag == KOOPA_RVT_GLOBAL_ALLOC && globals.count(base)){
+        return true;
+    }
+    /* a pointer from outside may point to any global */
+    if(!is_object(base) && !globals.empty()){
+        return true;
+    }
+    if(through_args){
+        for(auto arg : ir_values(call->kind.data.call.args)){
+            if(arg->ty->tag == KOOPA_RTT_POINTER
+                && bases_may_overlap(info, alias_base_object(arg), base)){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool alias_call_may_modify(const alias_info_t &info, const call_summaries_t &summaries,
+        koopa_raw_value_t call, koopa_raw_value_t ptr){
+    const auto &summary = summaries.at(call->kind.data.call.callee);
+    return call_may_access(info, summary.mod_globals, summary.mod_args, call, ptr);
+}
+
+bool alias_call_may_read(const alias_info_t &info, const call_summaries_t &summaries,
+        koopa_raw_value_t call, koopa_raw_value_t ptr){
+    const auto &summary = summaries.at(call->kind.data.call.callee);
+    return call_may_access(info, summary.ref_globals, summary.ref_args, call, ptr);
+}
+
+/* Pointer sets */
+
+/* Byte offset of `ptr` from its base object, if every index is a constant */
+static bool fixed_offset(koopa_raw_value_t ptr, int64_t &offset){
+    offset = 0;
+    for(auto &step : access_path(ptr)){
+        if(!ir_is_integer(step.index)){
+            return false;
+        }
+        offset += step.elem_size * step.index->kind.data.integer.value;
+    }
+    return true;
+}
+
+void alias_set_insert(alias_ptr_set_t &set, koopa_raw_value_t ptr){
+    if(!set.members.insert(ptr).second){
+        return;
+    }
+    auto base = alias_base_object(ptr);
+    int64_t offset;
+    if(fixed_offset(ptr, offset)){
+        set.fixed[base][offset].insert(ptr);
+    }
+    else{
+        set.varying[base].insert(ptr);
+    }
+}
+
+void alias_set_erase(alias_ptr_set_t &set, koopa_raw_value_t ptr){
+    if(set.members.erase(ptr) == 0){
+        return;
+    }
+    auto base = alias_base_object(ptr);
+    int64_t offset;
+    if(fixed_offset(ptr, offset)){
+        auto &offsets = set.fixed[base];
+        auto &ptrs = offsets[offset];
+        ptrs.erase(ptr);
+        if(ptrs.empty()){
+            offsets.erase(offset);
+        }
+        if(offsets.empty()){
+            set.fixed.erase(base);
+        }
+    }
+    else{
+        auto &ptrs = set.varying[base];
+        ptrs.erase(ptr);
+        if(ptrs.empty()){
+            set.varying.erase(base);
+        }
+    }
+}
+
+static void add_may_alias(const alias_info_t &info, const std::set<koopa_raw_value_t> &ptrs,
+        koopa_raw_value_t ptr, std::vector<koopa_raw_value_t> &found){
+    for(auto other : ptrs){
+        if(alias_may_alias(info, other, ptr)){
+            found.push_back(other);
+        }
+    }
+}
+
+std::vector<koopa_raw_value_t> alias_set_may_alias(const alias_info_t &info,
+        const alias_ptr_set_t &set, koopa_raw_value_t ptr){
+    auto base = alias_base_object(ptr);
+    int64_t offset;
+    bool is_fixed = fixed_offset(ptr, offset);
+    std::vector<koopa_raw_value_t> found;
+    for(auto &bucket : set.fixed){
+        if(bucket.first != base){
+            if(bases_may_overlap(info, base, bucket.first)){
+                for(auto &ptrs : bucket.second){
+                    found.insert(found.end(), ptrs.second.begin(), ptrs.second.end());
+                }
+            }
+        }
+        else if(is_fixed){
+            /* i32 accesses at distinct constant offsets are apart */
+            auto it = bucket.second.find(offset);
+            if(it != bucket.second.end()){
+                add_may_alias(info, it->second, ptr, found);
+            }
+        }
+        else{
+            for(auto &ptrs : bucket.second){
+                add_may_alias(info, ptrs.second, ptr, found);
+            }
+        }
+    }
+    for(auto &bucket : set.varying){
+        if(bucket.first != base){
+            if(bases_may_overlap(info, base, bucket.first)){
+                found.insert(found.end(), bucket.second.begin(), bucket.second.end());
+            }
+        }
+        else{
+            add_may_alias(info, bucket.second, ptr, found);
+        }
+    }
+    return found;
+}
+
+bool alias_set_has_must_alias(const alias_ptr_set_t &set, koopa_raw_value_t ptr){
+    if(set.members.count(ptr)){
+        return true;
+    }
+    /* only pointers with the same constant indices, or the same variables, must alias */
+    auto base = alias_base_object(ptr);
+    int64_t offset;
+    const std::set<koopa_raw_value_t> *ptrs = nullptr;
+    if(fixed_offset(ptr, offset)){
+        auto bucket = set.fixed.find(base);
+        if(bucket != set.fixed.end() && bucket->second.count(offset)){
+            ptrs = &bucket->second.at(offset);
+        }
+    }
+    else if(set.varying.count(base)){
+        ptrs = &set.varying.at(base);
+    }
+    if(ptrs != nullptr){
+        for(auto other : *ptrs){
+            if(alias_must_alias(other, ptr)){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* The members of the objects a call accesses, by base object (`call_may_access` looks at no more) */
+static std::vector<koopa_raw_value_t> set_call_access(const alias_info_t &info,
+        const std::set<koopa_raw_value_t> &globals, bool through_args,
+        const alias_ptr_set_t &set, koopa_raw_value_t call){
+    std::vector<koopa_raw_value_t> found;
+    for(auto &bucket : set.fixed){
+        if(call_may_access(info, globals, through_args, call, bucket.first)){
+            for(auto &ptrs : bucket.second){
+                found.insert(found.end(), ptrs.second.begin(), ptrs.second.end());
+            }
+        }
+    }
+    for(auto &bucket : set.varying){
+        if(call_may_access(info, globals, through_args, call, bucket.first)){
+            found.insert(found.end(), bucket.second.begin(), bucket.second.end());
+        }
+    }
+    return found;
+}
+
+std::vector<koopa_raw_value_t> alias_set_call_may_modify(const alias_info_t &info,
+        const call_summaries_t &summaries, const alias_ptr_set_t &set, koopa_raw_value_t call){
+    const auto &summary = summaries.at(call->kind.data.call.callee);
+    return set_call_access(info, summary.mod_globals, summary.mod_args, set, call);
+}
+
+std::vector<koopa_raw_value_t> alias_set_call_may_read(const alias_info_t &info,
+        const call_summaries_t &summaries, const alias_ptr_set_t &set, koopa_raw_value_t call){
+    const auto &summary = summaries.at(call->kind.data.call.callee);
+    return set_call_access(info, summary.ref_globals, summary.ref_args, set, call);
+}
+
+/* Dump */
+
+typedef std::map<koopa_raw_value_t, std::string> value_names_t;
+
+static std::string name_of(value_names_t &names, koopa_raw_value_t value){
+    if(ir_is_integer(value)){
+        return std::to_string(value->kind.data.integer.value);
+    }
+    auto it = names.find(value);
+    if(it != names.end()){
+        return it->second;
+    }
+    std::string name = (value->name != nullptr) ? value->name : "%v" + std::to_string(names.size());
+    names[value] = name;
+    return name;
+}
+
+static std::string describe(value_names_t &names, koopa_raw_value_t ptr){
+    std::string text = name_of(names, alias_base_object(ptr));
+    for(auto &step : access_path(ptr)){
+        int32_t offset;
+        auto base = ir_split_offset(step.index, offset);
+        text += step.is_elem ? "[" : "+[";
+        text += name_of(names, base);
+        if(offset != 0 && !ir_is_integer(base)){
+            text += (offset > 0 ? " + " : " - ") + std::to_string(offset > 0 ? offset : -(int64_t)offset);
+        }
+        text += "]";
+    }
+    return text;
+}
+
+void alias_dump(const koopa_raw_function_t &func){
+    alias_info_t info;
+    alias_analyze(func, info);
+
+    value_names_t names;
+    std::vector<koopa_raw_value_t> accesses;
+    std::cout << func->name << ":" << std::endl;
+    for(auto bb : ir_basic_blocks(func)){
+        for(auto inst : ir_values(bb->insts)){
+            koopa_raw_value_t ptr;
+            if(inst->kind.tag == KOOPA_RVT_LOAD){
+                ptr = inst->kind.data.load.src;
+            }
+            else if(inst->kind.tag == KOOPA_RVT_STORE){
+                ptr = inst->kind.data.store.dest;
+            }
+            else{
+                continue;
+            }
+            std::cout << "    " << accesses.size() << ": "
+                << (inst->kind.tag == KOOPA_RVT_LOAD ? "load " : "store ")
+                << describe(names, ptr) << std::endl;
+            accesses.push_back(ptr);
+        }
+    }
+    for(auto escaped : info.escaped){
+        std::cout << "    escaped: " << name_of(names, escaped) << std::endl;
+    }
+    for(size_t i = 0; i < accesses.size(); ++i){
+        for(size_t j = i + 1; j < accesses.size(); ++j){
+            std::cout << "    " << i << " " << j << ": "
+                << (alias_may_alias(info, accesses[i], accesses[j]) ? "may" : "no") << std::endl;
+        }
+    }
+}
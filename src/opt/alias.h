@@ -0,0 +1,96 @@
+#ifndef OPT_ALIAS_H
+#define OPT_ALIAS_H
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "koopa.h"
+
+/*
+    Alias queries on pointer values.
+
+    A pointer is traced back through getelemptr / getptr to the object it
+    points into: a local `alloc`, a global, or an unknown pointer (param,
+    block param, loaded pointer). Distinct named objects never overlap.
+    A param points into the caller's memory, never into the locals of the
+    current call; another unknown pointer may point into any global and
+    into the locals that escape (their address is passed to a call, to a
+    block or returned).
+
+    Two pointers into the same object are walked from it index by index.
+    At the first index where they differ by a known constant (`3` and `5`,
+    `%i` and `%i + 1`) they pick distinct elements; when only getelemptr
+    follow, the indices after it are taken to stay inside those elements.
+    Otherwise their byte offsets are compared as sums of `size * value`
+    terms plus a constant.
+*/
+
+typedef struct{
+    std::set<koopa_raw_value_t> escaped;    /* allocs */
+} alias_info_t;
+
+void alias_analyze(const koopa_raw_function_t &func, alias_info_t &info);
+
+/* The alloc / global / other pointer `ptr` is derived from */
+koopa_raw_value_t alias_base_object(koopa_raw_value_t ptr);
+
+/* Whether i32 accesses through `a` and `b` may overlap */
+bool alias_may_alias(const alias_info_t &info, koopa_raw_value_t a, koopa_raw_value_t b);
+/* Whether `a` and `b` always point to the same i32 */
+bool alias_must_alias(koopa_raw_value_t a, koopa_raw_value_t b);
+/* The values `alias_must_alias` tells `ptr` apart by: its base object and index variables */
+std::vector<koopa_raw_value_t> alias_path_values(koopa_raw_value_t ptr);
+/* Whether `a` and `b` may point into the same object, at any offsets */
+bool alias_may_share_object(const alias_info_t &info, koopa_raw_value_t a, koopa_raw_value_t b);
+
+/*
+    What a call may write and read: the globals it stores to / loads from,
+    itself or through its callees, and whether it does so through the
+    pointers it is passed. A library function (no body) only accesses
+    memory through its pointer args.
+*/
+typedef struct{
+    std::set<koopa_raw_value_t> mod_globals;
+    std::set<koopa_raw_value_t> ref_globals;
+    bool mod_args;
+    bool ref_args;
+} call_summary_t;
+
+typedef std::map<koopa_raw_function_t, call_summary_t> call_summaries_t;
+
+void alias_call_summaries(const koopa_raw_program_t &program, call_summaries_t &summaries);
+/* `call` may write / read the memory `ptr` points to */
+bool alias_call_may_modify(const alias_info_t &info, const call_summaries_t &summaries,
+        koopa_raw_value_t call, koopa_raw_value_t ptr);
+bool alias_call_may_read(const alias_info_t &info, const call_summaries_t &summaries,
+        koopa_raw_value_t call, koopa_raw_value_t ptr);
+
+/*
+    A set of pointers grouped by base object and, when every index is a
+    constant, by byte offset, so that the members an access may overlap
+    are found without asking about each one: a straight-line initializer
+    stays linear.
+*/
+typedef struct{
+    std::set<koopa_raw_value_t> members;
+    std::map<koopa_raw_value_t, std::map<int64_t, std::set<koopa_raw_value_t> > > fixed;
+    std::map<koopa_raw_value_t, std::set<koopa_raw_value_t> > varying;
+} alias_ptr_set_t;
+
+void alias_set_insert(alias_ptr_set_t &set, koopa_raw_value_t ptr);
+void alias_set_erase(alias_ptr_set_t &set, koopa_raw_value_t ptr);
+/* The members `alias_may_alias` / `alias_must_alias` with `ptr` */
+std::vector<koopa_raw_value_t> alias_set_may_alias(const alias_info_t &info,
+        const alias_ptr_set_t &set, koopa_raw_value_t ptr);
+bool alias_set_has_must_alias(const alias_ptr_set_t &set, koopa_raw_value_t ptr);
+/* The members `call` may write / read */
+std::vector<koopa_raw_value_t> alias_set_call_may_modify(const alias_info_t &info,
+        const call_summaries_t &summaries, const alias_ptr_set_t &set, koopa_raw_value_t call);
+std::vector<koopa_raw_value_t> alias_set_call_may_read(const alias_info_t &info,
+        const call_summaries_t &summaries, const alias_ptr_set_t &set, koopa_raw_value_t call);
+
+/* Every pair of loads / stores of `func` with the answer, for testing */
+void alias_dump(const koopa_raw_function_t &func);
+
+#endif /**< src/opt/alias.h */
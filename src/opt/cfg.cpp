@@ -0,0 +1,294 @@
+#include "cfg.h"
+#include "ir.h"
+
+#include <algorithm>
+#include <cassert>
+
+void cfg_build(const koopa_raw_function_t &func, cfg_t &cfg){
+    cfg.rpo.clear();
+    cfg.rpo_index.clear();
+    cfg.preds.clear();
+    cfg.succs.clear();
+
+    auto bbs = ir_basic_blocks(func);
+    if(bbs.empty()){
+        return;
+    }
+
+    /* iterative DFS; a block is finished once all its successors are */
+    std::set<koopa_raw_basic_block_t> visited;
+    std::vector<std::pair<koopa_raw_basic_block_t, size_t> > stack;
+    bb_list_t post_order;
+    stack.push_back({bbs[0], 0});
+    visited.insert(bbs[0]);
+    cfg.succs[bbs[0]] = ir_successors(bbs[0]);
+    while(!stack.empty()){
+        auto &top = stack.back();
+        auto &succs = cfg.succs[top.first];
+        if(top.second < succs.size()){
+            auto succ = succs[top.second++];
+            if(visited.insert(succ).second){
+                cfg.succs[succ] = ir_successors(succ);
+                stack.push_back({succ, 0});
+            }
+        }
+        else{
+            post_order.push_back(top.first);
+            stack.pop_back();
+        }
+    }
+
+    cfg.rpo.assign(post_order.rbegin(), post_order.rend());
+    for(size_t i = 0; i < cfg.rpo.size(); ++i){
+        cfg.rpo_index[cfg.rpo[i]] = i;
+        cfg.preds[cfg.rpo[i]];
+    }
+    for(auto bb : cfg.rpo){
+        for(auto succ : cfg.succs[bb]){
+            cfg.preds[succ].push_back(bb);
+        }
+    }
+}
+
+/* Cooper, Harvey & Kennedy, "A Simple, Fast Dominance Algorithm" */
+void dom_tree_build(const cfg_t &cfg, dom_tree_t &dom){
+    dom.idom.clear();
+    dom.children.clear();
+    dom.frontier.clear();
+    dom.pre.clear();
+    dom.post.clear();
+    if(cfg.rpo.empty()){
+        return;
+    }
+
+    auto entry = cfg.rpo[0];
+    std::map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> idom;
+    idom[entry] = entry;
+
+    auto intersect = [&](koopa_raw_basic_block_t a, koopa_raw_basic_block_t b){
+        while(a != b){
+            while(cfg.rpo_index.at(a) > cfg.rpo_index.at(b)){
+                a = idom[a];
+            }
+            while(cfg.rpo_index.at(b) > cfg.rpo_index.at(a)){
+                b = idom[b];
+            }
+        }
+        return a;
+    };
+
+    bool changed = true;
+    while(changed){
+        changed = false;
+        for(size_t i = 1; i < cfg.rpo.size(); ++i){
+            auto bb = cfg.rpo[i];
+            koopa_raw_basic_block_t new_idom = nullptr;
+            for(auto pred : cfg.preds.at(bb)){
+                if(idom.count(pred) == 0){
+                    continue;
+                }
+                new_idom = (new_idom == nullptr) ? pred : intersect(pred, new_idom);
+            }
+            assert(new_idom != nullptr);
+            if(idom[bb] != new_idom){
+                idom[bb] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    for(auto bb : cfg.rpo){
+        dom.idom[bb] = (bb == entry) ? nullptr : idom[bb];
+        dom.children[bb];
+        dom.frontier[bb];
+    }
+    for(auto bb : cfg.rpo){
+        if(bb != entry){
+            dom.children[idom[bb]].push_back(bb);
+        }
+    }
+
+    /* pre / post numbers of a DFS over the tree, without recursion */
+    int counter = 0;
+    std::vector<std::pair<koopa_raw_basic_block_t, size_t> > stack = {{entry, 0}};
+    dom.pre[entry] = counter++;
+    while(!stack.empty()){
+        auto &top = stack.back();
+        auto &children = dom.children[top.first];
+        if(top.second < children.size()){
+            auto child = children[top.second++];
+            dom.pre[child] = counter++;
+            stack.push_back({child, 0});
+        }
+        else{
+            dom.post[top.first] = counter++;
+            stack.pop_back();
+        }
+    }
+
+    for(auto bb : cfg.rpo){
+        auto &preds = cfg.preds.at(bb);
+        if(preds.size() < 2){
+            continue;
+        }
+        for(auto pred : preds){
+            auto runner = pred;
+            while(runner != idom[bb]){
+                dom.frontier[runner].insert(bb);
+                runner = idom[runner];
+            }
+        }
+    }
+}
+
+bool dom_tree_dominates(const dom_tree_t &dom,
+        koopa_raw_basic_block_t a, koopa_raw_basic_block_t b){
+    auto it = dom.pre.find(a);
+    if(it == dom.pre.end()){
+        return false;
+    }
+    return it->second <= dom.pre.at(b) && dom.post.at(b) <= dom.post.at(a);
+}
+
+void loops_build(const cfg_t &cfg, const dom_tree_t &dom, std::vector<loop_t> &loops){
+    loops.clear();
+    std::map<koopa_raw_basic_block_t, size_t> loop_of_header;
+    for(auto bb : cfg.rpo){
+        for(auto succ : cfg.succs.at(bb)){
+            /* only an edge against reverse post-order can be a back edge */
+            if(cfg.rpo_index.at(succ) > cfg.rpo_index.at(bb) || !dom_tree_dominates(dom, succ, bb)){
+                continue;
+            }
+            /* bb -> succ is a back edge */
+            auto it = loop_of_header.find(succ);
+            if(it == loop_of_header.end()){
+                it = loop_of_header.insert({succ, loops.size()}).first;
+                loops.push_back({succ, nullptr, {succ}, {}, -1, 0});
+            }
+            auto &loop = loops[it->second];
+            loop.latches.push_back(bb);
+
+            /* everything reaching the latch without going through the header */
+            bb_list_t worklist = {bb};
+            while(!worklist.empty()){
+                auto block = worklist.back();
+                worklist.pop_back();
+                if(loop.blocks.insert(block).second){
+                    auto &preds = cfg.preds.at(block);
+                    worklist.insert(worklist.end(), preds.begin(), preds.end());
+                }
+            }
+        }
+    }
+
+    /* an inner loop has fewer blocks than any loop containing it */
+    std::stable_sort(loops.begin(), loops.end(), [](const loop_t &a, const loop_t &b){
+        return a.blocks.size() < b.blocks.size();
+    });
+    for(size_t i = 0; i < loops.size(); ++i){
+        auto &loop = loops[i];
+        for(size_t j = i + 1; j < loops.size(); ++j){
+            if(loops[j].blocks.count(loop.header)){
+                loop.parent = j;
+                break;
+            }
+        }
+
+        bb_list_t entering;
+        for(auto pred : cfg.preds.at(loop.header)){
+            if(loop.blocks.count(pred) == 0){
+                entering.push_back(pred);
+            }
+        }
+        if(entering.size() == 1 && cfg.succs.at(entering[0]).size() == 1){
+            loop.preheader = entering[0];
+        }
+    }
+    for(size_t i = loops.size(); i-- > 0;){
+        auto &loop = loops[i];
+        loop.depth = (loop.parent < 0) ? 1 : loops[loop.parent].depth + 1;
+    }
+}
+
+/*
+    Edges from outside the loop go to a new block that jumps to the header.
+    With a single such edge, its args move to that jump; otherwise the new
+    block takes the header's params and passes them on.
+*/
+static void insert_preheader(const cfg_t &cfg, const loop_t &loop,
+        std::vector<koopa_raw_basic_block_t> &bbs){
+    auto header = loop.header;
+    bb_list_t entering;
+    size_t num_edges = 0;
+    for(auto pred : cfg.preds.at(header)){
+        if(loop.blocks.count(pred) == 0){
+            entering.push_back(pred);
+        }
+    }
+    std::sort(entering.begin(), entering.end());
+    entering.erase(std::unique(entering.begin(), entering.end()), entering.end());
+    for(auto pred : entering){
+        for(auto succ : ir_successors(pred)){
+            num_edges += (succ == header);
+        }
+    }
+
+    auto preheader = ir_new_basic_block("preheader");
+    bool move_args = (num_edges == 1);
+    std::vector<koopa_raw_value_t> jump_args;
+    if(!move_args){
+        std::vector<koopa_raw_value_t> params;
+        for(auto param : ir_values(header->params)){
+            params.push_back(ir_new_value(param->ty, KOOPA_RVT_BLOCK_ARG_REF));
+        }
+        ir_set_params(preheader, params);
+        jump_args = params;
+    }
+
+    auto redirect = [&](koopa_raw_basic_block_t &target, koopa_raw_slice_t &args){
+        if(target != header){
+            return;
+        }
+        target = preheader;
+        if(move_args){
+            jump_args = ir_values(args);
+            args = ir_new_slice(std::vector<koopa_raw_value_t>());
+        }
+    };
+    for(auto pred : entering){
+        auto &kind = ir_mut(ir_terminator(pred))->kind;
+        if(kind.tag == KOOPA_RVT_JUMP){
+            redirect(kind.data.jump.target, kind.data.jump.args);
+        }
+        else if(kind.tag == KOOPA_RVT_BRANCH){
+            redirect(kind.data.branch.true_bb, kind.data.branch.true_args);
+            redirect(kind.data.branch.false_bb, kind.data.branch.false_args);
+        }
+    }
+    ir_set_insts(preheader, {ir_new_jump(header, jump_args)});
+
+    bbs.insert(std::find(bbs.begin(), bbs.end(), header), preheader);
+}
+
+bool loops_insert_preheaders(const koopa_raw_function_t &func){
+    cfg_t cfg;
+    dom_tree_t dom;
+    std::vector<loop_t> loops;
+    cfg_build(func, cfg);
+    dom_tree_build(cfg, dom);
+    loops_build(cfg, dom, loops);
+
+    auto bbs = ir_basic_blocks(func);
+    bool changed = false;
+    for(auto &loop : loops){
+        /* the entry block cannot be jumped to, so it is never a header */
+        if(loop.preheader == nullptr){
+            insert_preheader(cfg, loop, bbs);
+            changed = true;
+        }
+    }
+    if(changed){
+        ir_set_basic_blocks(func, bbs);
+    }
+    return changed;
+}
@@ -0,0 +1,54 @@
+#ifndef OPT_CFG_H
+#define OPT_CFG_H
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "koopa.h"
+
+typedef std::vector<koopa_raw_basic_block_t> bb_list_t;
+
+/* Control flow graph of the blocks reachable from the entry */
+typedef struct{
+    bb_list_t rpo;  /* reverse post-order, entry first */
+    std::map<koopa_raw_basic_block_t, int> rpo_index;
+    std::map<koopa_raw_basic_block_t, bb_list_t> preds;
+    std::map<koopa_raw_basic_block_t, bb_list_t> succs;
+} cfg_t;
+
+typedef struct{
+    std::map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> idom;   /* entry -> nullptr */
+    std::map<koopa_raw_basic_block_t, bb_list_t> children;
+    std::map<koopa_raw_basic_block_t, std::set<koopa_raw_basic_block_t> > frontier;
+    /* a dominates b iff pre[a] <= pre[b] and post[b] <= post[a] */
+    std::map<koopa_raw_basic_block_t, int> pre;
+    std::map<koopa_raw_basic_block_t, int> post;
+} dom_tree_t;
+
+/*
+    Natural loop of the back edges into `header`. The preheader is the
+    only block outside the loop entering it, ending in a `jump` to the
+    header; nullptr until `loops_insert_preheaders` makes one.
+*/
+typedef struct{
+    koopa_raw_basic_block_t header;
+    koopa_raw_basic_block_t preheader;
+    std::set<koopa_raw_basic_block_t> blocks;
+    bb_list_t latches;
+    int parent;     /* index of the enclosing loop, -1 at the top level */
+    int depth;      /* 1 for an outermost loop */
+} loop_t;
+
+void cfg_build(const koopa_raw_function_t &func, cfg_t &cfg);
+
+void dom_tree_build(const cfg_t &cfg, dom_tree_t &dom);
+bool dom_tree_dominates(const dom_tree_t &dom,
+        koopa_raw_basic_block_t a, koopa_raw_basic_block_t b);
+
+/* Innermost loops first */
+void loops_build(const cfg_t &cfg, const dom_tree_t &dom, std::vector<loop_t> &loops);
+/* Give every loop of `func` a preheader; true if blocks were added */
+bool loops_insert_preheaders(const koopa_raw_function_t &func);
+
+#endif /**< src/opt/cfg.h */
@@ -0,0 +1,248 @@
+#include "opt.h"
+#include "ir.h"
+#include "cfg.h"
+#include "alias.h"
+
+#include <algorithm>
+#include <set>
+
+/*
+    Dead store elimination.
+
+    A store is dead when its location is stored to again on every path
+    from it before anything may read it. A backward dataflow over the CFG
+    finds, at every point, the pointers sure to be overwritten first: a
+    store adds its destination, a load removes what may alias its source,
+    a call what the callee may read (`alias.h` summaries), and nothing is
+    overwritten at the exit. It starts from nothing and only grows, so a
+    store inside a loop is only removed for an overwrite in the same trip.
+    Walking back past the definition of a value a pointer is told apart
+    by (`alias_path_values`), such as the counter at a loop header, drops
+    the pointer: above it the value is the one of an earlier trip, and the
+    same address expression names another element.
+
+    A local that does not escape is gone once the function returns: a
+    store into it is dead as well when no load that may alias it can be
+    reached from the store. The loads of each block are gathered once and
+    passed back over the CFG to a fixed point, rather than looked for from
+    every store. ADCE then drops the `alloc`s and addresses left without
+    a use, and their frame slots with them.
+
+    Both keep their pointers in `alias_ptr_set_t`s, so a long run of
+    stores into one array is not checked pair by pair.
+*/
+
+typedef struct{
+    const call_summaries_t *summaries;
+    alias_info_t alias;
+    cfg_t cfg;
+    std::set<koopa_raw_value_t> path_values;    /* of store destinations */
+} dse_t;
+
+static void drop(alias_ptr_set_t &state, const std::vector<koopa_raw_value_t> &ptrs){
+    for(auto ptr : ptrs){
+        alias_set_erase(state, ptr);
+    }
+}
+
+/* Above the definition of `value`, the pointers told apart by it */
+static void drop_defined(const dse_t &d, alias_ptr_set_t &state, koopa_raw_value_t value){
+    if(d.path_values.count(value) == 0){
+        return;
+    }
+    std::vector<koopa_raw_value_t> defined;
+    for(auto ptr : state.members){
+        auto values = alias_path_values(ptr);
+        if(std::find(values.begin(), values.end(), value) != values.end()){
+            defined.push_back(ptr);
+        }
+    }
+    drop(state, defined);
+}
+
+/*
+    Runs `bb` backwards from `state`, what is overwritten at its end.
+    With `dead` given, the stores found dead are added to it.
+*/
+static void transfer(const dse_t &d, koopa_raw_basic_block_t bb, alias_ptr_set_t &state,
+        std::set<koopa_raw_value_t> *dead){
+    auto insts = ir_values(bb->insts);
+    for(size_t i = insts.size(); i-- > 0;){
+        auto inst = insts[i];
+        if(inst->kind.tag == KOOPA_RVT_STORE){
+            auto dest = inst->kind.data.store.dest;
+            if(alias_set_has_must_alias(state, dest)){
+                if(dead != nullptr){
+                    dead->insert(inst);
+                }
+                continue;
+            }
+            alias_set_insert(state, dest);
+        }
+        else if(inst->kind.tag == KOOPA_RVT_LOAD){
+            drop(state, alias_set_may_alias(d.alias, state, inst->kind.data.load.src));
+        }
+        else if(inst->kind.tag == KOOPA_RVT_CALL){
+            drop(state, alias_set_call_may_read(d.alias, *d.summaries, state, inst));
+        }
+        drop_defined(d, state, inst);
+    }
+    for(auto param : ir_values(bb->params)){
+        drop_defined(d, state, param);
+    }
+}
+
+/* What is overwritten on every successor of `bb` */
+static alias_ptr_set_t meet(const dse_t &d, const std::map<koopa_raw_basic_block_t, alias_ptr_set_t> &states,
+        koopa_raw_basic_block_t bb){
+    const auto &succs = d.cfg.succs.at(bb);
+    if(succs.empty()){
+        return {};
+    }
+    alias_ptr_set_t out;
+    for(auto ptr : states.at(succs[0]).members){
+        bool everywhere = true;
+        for(size_t i = 1; i < succs.size() && everywhere; ++i){
+            everywhere = alias_set_has_must_alias(states.at(succs[i]), ptr);
+        }
+        if(everywhere){
+            alias_set_insert(out, ptr);
+        }
+    }
+    return out;
+}
+
+static void find_overwritten(const dse_t &d, std::set<koopa_raw_value_t> &dead){
+    /* what is overwritten at the start of each block */
+    std::map<koopa_raw_basic_block_t, alias_ptr_set_t> states;
+    for(auto bb : d.cfg.rpo){
+        states[bb] = {};
+    }
+    bool changed = true;
+    while(changed){
+        changed = false;
+        for(size_t i = d.cfg.rpo.size(); i-- > 0;){
+            auto bb = d.cfg.rpo[i];
+            auto state = meet(d, states, bb);
+            transfer(d, bb, state, nullptr);
+            if(states[bb].members != state.members){
+                states[bb] = state;
+                changed = true;
+            }
+        }
+    }
+    for(auto bb : d.cfg.rpo){
+        auto state = meet(d, states, bb);
+        transfer(d, bb, state, &dead);
+    }
+}
+
+static bool is_local(const dse_t &d, koopa_raw_value_t ptr){
+    auto base = alias_base_object(ptr);
+    return base->kind.tag == KOOPA_RVT_ALLOC && d.alias.escaped.count(base) == 0;
+}
+
+/* Only a load from the same local may read a local that does not escape */
+static void add_loads(const dse_t &d, alias_ptr_set_t &loaded, koopa_raw_value_t inst){
+    if(inst->kind.tag == KOOPA_RVT_LOAD && is_local(d, inst->kind.data.load.src)){
+        alias_set_insert(loaded, inst->kind.data.load.src);
+    }
+}
+
+static bool add_all(alias_ptr_set_t &to, const alias_ptr_set_t &from){
+    size_t size = to.members.size();
+    for(auto ptr : from.members){
+        alias_set_insert(to, ptr);
+    }
+    return to.members.size() != size;
+}
+
+static void find_unread_locals(const dse_t &d, std::set<koopa_raw_value_t> &dead){
+    /* the local loads of each block, and those reachable from its end */
+    std::map<koopa_raw_basic_block_t, alias_ptr_set_t> gen, loaded_out;
+    for(auto bb : d.cfg.rpo){
+        for(auto inst : ir_values(bb->insts)){
+            add_loads(d, gen[bb], inst);
+        }
+        loaded_out[bb] = {};
+    }
+    bool changed = true;
+    while(changed){
+        changed = false;
+        for(size_t i = d.cfg.rpo.size(); i-- > 0;){
+            auto bb = d.cfg.rpo[i];
+            for(auto succ : d.cfg.succs.at(bb)){
+                changed |= add_all(loaded_out[bb], gen[succ]);
+                changed |= add_all(loaded_out[bb], loaded_out[succ]);
+            }
+        }
+    }
+    for(auto bb : d.cfg.rpo){
+        auto insts = ir_values(bb->insts);
+        bool has_local_store = false;
+        for(auto inst : insts){
+            has_local_store |= (inst->kind.tag == KOOPA_RVT_STORE && is_local(d, inst->kind.data.store.dest));
+        }
+        if(!has_local_store){
+            continue;
+        }
+        /* what is loaded after the current point, walking the block backwards */
+        alias_ptr_set_t loaded = loaded_out[bb];
+        for(size_t i = insts.size(); i-- > 0;){
+            auto store = insts[i];
+            add_loads(d, loaded, store);
+            if(store->kind.tag != KOOPA_RVT_STORE || !is_local(d, store->kind.data.store.dest)){
+                continue;
+            }
+            if(alias_set_may_alias(d.alias, loaded, store->kind.data.store.dest).empty()){
+                dead.insert(store);
+            }
+        }
+    }
+}
+
+static void eliminate_stores(const koopa_raw_function_t &func, const call_summaries_t &summaries){
+    ir_remove_unreachable_blocks(func);
+
+    dse_t d;
+    d.summaries = &summaries;
+    alias_analyze(func, d.alias);
+    cfg_build(func, d.cfg);
+    for(auto bb : d.cfg.rpo){
+        for(auto inst : ir_values(bb->insts)){
+            if(inst->kind.tag == KOOPA_RVT_STORE){
+                auto values = alias_path_values(inst->kind.data.store.dest);
+                d.path_values.insert(values.begin(), values.end());
+            }
+        }
+    }
+
+    std::set<koopa_raw_value_t> dead;
+    find_overwritten(d, dead);
+    find_unread_locals(d, dead);
+    if(dead.empty()){
+        return;
+    }
+    for(auto bb : d.cfg.rpo){
+        std::vector<koopa_raw_value_t> insts;
+        for(auto inst : ir_values(bb->insts)){
+            if(dead.count(inst) == 0){
+                insts.push_back(inst);
+            }
+        }
+        if(insts.size() != bb->insts.len){
+            ir_set_insts(bb, insts);
+        }
+    }
+}
+
+void opt_dse(const koopa_raw_program_t &program){
+    call_summaries_t summaries;
+    alias_call_summaries(program, summaries);
+    for(size_t i = 0; i < program.funcs.len; ++i){
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if(func->bbs.len > 0){
+            eliminate_stores(func, summaries);
+        }
+    }
+}
@@ -0,0 +1,168 @@
+#include "opt.h"
+#include "ir.h"
+#include "cfg.h"
+#include "alias.h"
+
+#include <algorithm>
+
+/*
+    Global value numbering over the dominator tree.
+
+    A pure instruction (binary, getelemptr, getptr) is keyed by its
+    operation and operands; if an equal one is available in a dominating
+    position, it is replaced by it. Keys are canonical: integers compare
+    by value, commutative operands are sorted and `gt`/`ge` are written as
+    `lt`/`le` with the operands swapped.
+
+    Loads are only reused within a block: a load of the same pointer
+    stays available until a store that may alias it, or a call.
+*/
+
+typedef std::vector<int64_t> gvn_key_t;
+
+typedef struct{
+    std::map<gvn_key_t, koopa_raw_value_t> table;
+    value_map_t repl;
+    alias_info_t alias;
+} gvn_t;
+
+static koopa_raw_value_t resolve(const gvn_t &g, koopa_raw_value_t value){
+    auto it = g.repl.find(value);
+    while(it != g.repl.end()){
+        value = it->second;
+        it = g.repl.find(value);
+    }
+    return value;
+}
+
+static std::pair<int64_t, int64_t> operand_key(koopa_raw_value_t value){
+    if(ir_is_integer(value)){
+        return {1, value->kind.data.integer.value};
+    }
+    return {0, (int64_t)(intptr_t)value};
+}
+
+static bool is_commutative(koopa_raw_binary_op_t op){
+    switch (op)
+    {
+    case KOOPA_RBO_NOT_EQ:
+    case KOOPA_RBO_EQ:
+    case KOOPA_RBO_ADD:
+    case KOOPA_RBO_MUL:
+    case KOOPA_RBO_AND:
+    case KOOPA_RBO_OR:
+    case KOOPA_RBO_XOR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool make_key(koopa_raw_value_t inst, gvn_key_t &key){
+    koopa_raw_value_t lhs, rhs;
+    int64_t op;
+    const auto &kind = inst->kind;
+    switch (kind.tag)
+    {
+    case KOOPA_RVT_BINARY:
+        op = kind.data.binary.op;
+        lhs = kind.data.binary.lhs;
+        rhs = kind.data.binary.rhs;
+        if(op == KOOPA_RBO_GT || op == KOOPA_RBO_GE){
+            op = (op == KOOPA_RBO_GT) ? KOOPA_RBO_LT : KOOPA_RBO_LE;
+            std::swap(lhs, rhs);
+        }
+        break;
+    case KOOPA_RVT_GET_ELEM_PTR:
+        op = 0;
+        lhs = kind.data.get_elem_ptr.src;
+        rhs = kind.data.get_elem_ptr.index;
+        break;
+    case KOOPA_RVT_GET_PTR:
+        op = 0;
+        lhs = kind.data.get_ptr.src;
+        rhs = kind.data.get_ptr.index;
+        break;
+    default:
+        return false;
+    }
+
+    auto key_lhs = operand_key(lhs);
+    auto key_rhs = operand_key(rhs);
+    if(kind.tag == KOOPA_RVT_BINARY && is_commutative(kind.data.binary.op)
+        && key_rhs < key_lhs){
+        std::swap(key_lhs, key_rhs);
+    }
+    key = {kind.tag, op, key_lhs.first, key_lhs.second, key_rhs.first, key_rhs.second};
+    return true;
+}
+
+static void visit(const dom_tree_t &dom, gvn_t &g, koopa_raw_basic_block_t bb){
+    std::vector<gvn_key_t> inserted;
+    std::map<koopa_raw_value_t, koopa_raw_value_t> loads;
+    std::vector<koopa_raw_value_t> insts;
+
+    for(auto inst : ir_values(bb->insts)){
+        ir_rewrite_operands(inst, [&](koopa_raw_value_t v){ return resolve(g, v); });
+
+        if(inst->kind.tag == KOOPA_RVT_LOAD){
+            auto src = inst->kind.data.load.src;
+            auto it = loads.find(src);
+            if(it != loads.end()){
+                g.repl[inst] = it->second;
+                continue;
+            }
+            loads[src] = inst;
+        }
+        else if(inst->kind.tag == KOOPA_RVT_STORE){
+            auto dest = inst->kind.data.store.dest;
+            for(auto it = loads.begin(); it != loads.end();){
+                if(alias_may_alias(g.alias, it->first, dest)){
+                    it = loads.erase(it);
+                }
+                else{
+                    ++it;
+                }
+            }
+        }
+        else if(inst->kind.tag == KOOPA_RVT_CALL){
+            loads.clear();
+        }
+        else{
+            gvn_key_t key;
+            if(make_key(inst, key)){
+                auto it = g.table.find(key);
+                if(it != g.table.end()){
+                    g.repl[inst] = it->second;
+                    continue;
+                }
+                g.table[key] = inst;
+                inserted.push_back(key);
+            }
+        }
+        insts.push_back(inst);
+    }
+    ir_set_insts(bb, insts);
+
+    for(auto child : dom.children.at(bb)){
+        visit(dom, g, child);
+    }
+
+    for(auto &key : inserted){
+        g.table.erase(key);
+    }
+}
+
+void opt_gvn(const koopa_raw_function_t &func){
+    ir_remove_unreachable_blocks(func);
+
+    cfg_t cfg;
+    dom_tree_t dom;
+    cfg_build(func, cfg);
+    dom_tree_build(cfg, dom);
+
+    gvn_t g;
+    alias_analyze(func, g.alias);
+    visit(dom, g, cfg.rpo[0]);
+    ir_replace_uses(func, g.repl);
+}
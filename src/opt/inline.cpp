@@ -0,0 +1,299 @@
+#include "opt.h"
+#include "ir.h"
+#include "cfg.h"
+
+#include <algorithm>
+#include <set>
+
+/*
+    Function inlining, bottom-up over the call graph.
+
+    Callees are done before their callers, so a body is copied with its
+    own calls already inlined. Functions on a cycle of the call graph
+    (recursive ones) are never inlined.
+
+    The cost model counts IR instructions. A callee is inlined when its
+    size is within `INLINE_BASE_COST`, raised for every constant argument
+    (SCCP folds them afterwards) and for every loop around the call site.
+    A function with a single call site left is inlined up to a much larger
+    size, as its body is then emitted for that one call anyway. A caller
+    stops growing at `INLINE_CALLER_LIMIT`.
+
+    The block holding the call is split after it; the callee's blocks are
+    copied in between, with its params replaced by the arguments and its
+    `alloc`s moved to the caller's entry. Every `ret` jumps to the second
+    half, passing the return value as a block param.
+*/
+
+static const size_t INLINE_BASE_COST = 30;
+static const size_t INLINE_CONST_ARG_BONUS = 10;
+static const size_t INLINE_LOOP_BONUS = 40;         /* per loop level, up to 3 */
+static const size_t INLINE_SINGLE_SITE_COST = 400;
+static const size_t INLINE_CALLER_LIMIT = 4000;
+
+typedef std::vector<koopa_raw_function_t> func_list_t;
+typedef std::map<koopa_raw_function_t, std::set<koopa_raw_function_t> > call_graph_t;
+typedef std::map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> bb_map_t;
+
+typedef struct{
+    call_graph_t callees;
+    std::set<koopa_raw_function_t> recursive;
+    std::map<koopa_raw_function_t, size_t> call_sites;
+} inliner_t;
+
+static bool has_body(koopa_raw_function_t func){
+    return func->bbs.len > 0;
+}
+
+static size_t function_size(koopa_raw_function_t func){
+    size_t size = 0;
+    for(auto bb : ir_basic_blocks(func)){
+        size += bb->insts.len;
+    }
+    return size;
+}
+
+static bool reaches(const call_graph_t &callees, koopa_raw_function_t from,
+        koopa_raw_function_t to, std::set<koopa_raw_function_t> &visited){
+    for(auto callee : callees.at(from)){
+        if(callee == to){
+            return true;
+        }
+        if(visited.insert(callee).second && reaches(callees, callee, to, visited)){
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Callees first */
+static void post_order(const call_graph_t &callees, koopa_raw_function_t func,
+        std::set<koopa_raw_function_t> &visited, func_list_t &order){
+    if(!visited.insert(func).second){
+        return;
+    }
+    for(auto callee : callees.at(func)){
+        post_order(callees, callee, visited, order);
+    }
+    order.push_back(func);
+}
+
+/* Loop depth of every block of `func` */
+static std::map<koopa_raw_basic_block_t, int> loop_depths(const koopa_raw_function_t &func){
+    cfg_t cfg;
+    dom_tree_t dom;
+    std::vector<loop_t> loops;
+    cfg_build(func, cfg);
+    dom_tree_build(cfg, dom);
+    loops_build(cfg, dom, loops);
+
+    std::map<koopa_raw_basic_block_t, int> depth;
+    for(auto bb : ir_basic_blocks(func)){
+        depth[bb] = 0;
+    }
+    for(auto &loop : loops){
+        for(auto bb : loop.blocks){
+            depth[bb] = std::max(depth[bb], loop.depth);
+        }
+    }
+    return depth;
+}
+
+static bool should_inline(const inliner_t &in, koopa_raw_function_t caller,
+        koopa_raw_value_t call, int depth, size_t caller_size){
+    auto callee = call->kind.data.call.callee;
+    if(!has_body(callee) || callee == caller || in.recursive.count(callee)){
+        return false;
+    }
+    size_t size = function_size(callee);
+    if(caller_size + size > INLINE_CALLER_LIMIT){
+        return false;
+    }
+    if(in.call_sites.at(callee) == 1){
+        return size <= INLINE_SINGLE_SITE_COST;
+    }
+    size_t budget = INLINE_BASE_COST + INLINE_LOOP_BONUS * std::min(depth, 3);
+    for(auto arg : ir_values(call->kind.data.call.args)){
+        if(ir_is_integer(arg)){
+            budget += INLINE_CONST_ARG_BONUS;
+        }
+    }
+    return size <= budget;
+}
+
+/*
+    Inline the call `insts[index]` of `bb`. Returns the copied blocks
+    followed by the block with the rest of `bb`.
+*/
+static std::vector<koopa_raw_basic_block_t> inline_call(inliner_t &in,
+        const koopa_raw_function_t &caller, koopa_raw_basic_block_t bb, size_t index){
+    auto insts = ir_values(bb->insts);
+    auto call = insts[index];
+    auto callee = call->kind.data.call.callee;
+
+    value_map_t values;
+    bb_map_t bbs;
+    auto params = ir_values(callee->params);
+    auto args = ir_values(call->kind.data.call.args);
+    for(size_t i = 0; i < params.size(); ++i){
+        values[params[i]] = args[i];
+    }
+
+    /* the rest of `bb`, receiving the return value */
+    auto cont = ir_new_basic_block("inline_ret");
+    ir_set_insts(cont, std::vector<koopa_raw_value_t>(insts.begin() + index + 1, insts.end()));
+    koopa_raw_value_t result = nullptr;
+    if(call->ty->tag != KOOPA_RTT_UNIT){
+        result = ir_new_value(call->ty, KOOPA_RVT_BLOCK_ARG_REF);
+        ir_set_params(cont, {result});
+    }
+
+    std::vector<koopa_raw_basic_block_t> copies;
+    std::vector<koopa_raw_value_t> allocs;
+    for(auto callee_bb : ir_basic_blocks(callee)){
+        auto copy = ir_new_basic_block("inline");
+        bbs[callee_bb] = copy;
+        copies.push_back(copy);
+        std::vector<koopa_raw_value_t> copy_params;
+        for(auto param : ir_values(callee_bb->params)){
+            copy_params.push_back(ir_new_value(param->ty, KOOPA_RVT_BLOCK_ARG_REF));
+            values[param] = copy_params.back();
+        }
+        ir_set_params(copy, copy_params);
+        std::vector<koopa_raw_value_t> copy_insts;
+        for(auto inst : ir_values(callee_bb->insts)){
+            auto copy_value = ir_copy_inst(inst);
+            values[inst] = copy_value;
+            if(inst->kind.tag == KOOPA_RVT_ALLOC){
+                allocs.push_back(copy_value);
+                continue;
+            }
+            if(inst->kind.tag == KOOPA_RVT_CALL){
+                in.call_sites[inst->kind.data.call.callee]++;
+            }
+            copy_insts.push_back(copy_value);
+        }
+        ir_set_insts(copy, copy_insts);
+    }
+
+    /* operands and targets, now that every value has its copy */
+    auto lookup = [&](koopa_raw_value_t v){
+        auto it = values.find(v);
+        return (it == values.end()) ? v : it->second;
+    };
+    for(auto copy : copies){
+        auto copy_insts = ir_values(copy->insts);
+        for(auto &inst : copy_insts){
+            ir_rewrite_operands(inst, lookup);
+            auto &kind = ir_mut(inst)->kind;
+            if(kind.tag == KOOPA_RVT_BRANCH){
+                kind.data.branch.true_bb = bbs[kind.data.branch.true_bb];
+                kind.data.branch.false_bb = bbs[kind.data.branch.false_bb];
+            }
+            else if(kind.tag == KOOPA_RVT_JUMP){
+                kind.data.jump.target = bbs[kind.data.jump.target];
+            }
+            else if(kind.tag == KOOPA_RVT_RETURN){
+                std::vector<koopa_raw_value_t> ret_args;
+                if(result != nullptr){
+                    ret_args.push_back(kind.data.ret.value);
+                }
+                inst = ir_new_jump(cont, ret_args);
+            }
+        }
+        ir_set_insts(copy, copy_insts);
+    }
+
+    std::vector<koopa_raw_value_t> head(insts.begin(), insts.begin() + index);
+    head.push_back(ir_new_jump(copies[0], {}));
+    ir_set_insts(bb, head);
+    in.call_sites[callee]--;
+
+    auto caller_bbs = ir_basic_blocks(caller);
+    auto entry = caller_bbs[0];
+    auto entry_insts = ir_values(entry->insts);
+    entry_insts.insert(entry_insts.begin(), allocs.begin(), allocs.end());
+    ir_set_insts(entry, entry_insts);
+
+    copies.push_back(cont);
+    for(size_t i = 0; i < caller_bbs.size(); ++i){
+        if(caller_bbs[i] == bb){
+            caller_bbs.insert(caller_bbs.begin() + i + 1, copies.begin(), copies.end());
+            break;
+        }
+    }
+    ir_set_basic_blocks(caller, caller_bbs);
+    if(result != nullptr){
+        ir_replace_uses(caller, {{call, result}});
+    }
+    return copies;
+}
+
+static void inline_into(inliner_t &in, const koopa_raw_function_t &caller){
+    auto depth = loop_depths(caller);
+    size_t caller_size = function_size(caller);
+    std::set<koopa_raw_basic_block_t> copied;
+
+    auto bbs = ir_basic_blocks(caller);
+    for(size_t i = 0; i < bbs.size(); ++i){
+        auto bb = bbs[i];
+        if(copied.count(bb)){
+            continue;
+        }
+        auto insts = ir_values(bb->insts);
+        for(size_t k = 0; k < insts.size(); ++k){
+            auto inst = insts[k];
+            if(inst->kind.tag != KOOPA_RVT_CALL
+                || !should_inline(in, caller, inst, depth[bb], caller_size)){
+                continue;
+            }
+            caller_size += function_size(inst->kind.data.call.callee);
+            auto added = inline_call(in, caller, bb, k);
+            auto cont = added.back();
+            added.pop_back();
+            copied.insert(added.begin(), added.end());
+            depth[cont] = depth[bb];
+            /* the rest of `bb` is looked at when the loop reaches `cont` */
+            bbs = ir_basic_blocks(caller);
+            break;
+        }
+    }
+}
+
+void opt_inline(const koopa_raw_program_t &program){
+    inliner_t in;
+    func_list_t funcs;
+    for(size_t i = 0; i < program.funcs.len; ++i){
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        funcs.push_back(func);
+        in.callees[func];
+        in.call_sites[func] = 0;
+    }
+    for(auto func : funcs){
+        for(auto bb : ir_basic_blocks(func)){
+            for(auto inst : ir_values(bb->insts)){
+                if(inst->kind.tag == KOOPA_RVT_CALL){
+                    in.callees[func].insert(inst->kind.data.call.callee);
+                    in.call_sites[inst->kind.data.call.callee]++;
+                }
+            }
+        }
+    }
+    for(auto func : funcs){
+        std::set<koopa_raw_function_t> visited;
+        if(reaches(in.callees, func, func, visited)){
+            in.recursive.insert(func);
+        }
+    }
+
+    std::set<koopa_raw_function_t> visited;
+    func_list_t order;
+    for(auto func : funcs){
+        post_order(in.callees, func, visited, order);
+    }
+    for(auto func : order){
+        if(has_body(func)){
+            inline_into(in, func);
+        }
+    }
+}
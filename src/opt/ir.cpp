@@ -0,0 +1,483 @@
+#include "ir.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <set>
+
+static int new_bb_id = 0;
+
+koopa_raw_value_data_t *ir_mut(koopa_raw_value_t value){
+    return const_cast<koopa_raw_value_data_t *>(value);
+}
+
+koopa_raw_basic_block_data_t *ir_mut(koopa_raw_basic_block_t bb){
+    return const_cast<koopa_raw_basic_block_data_t *>(bb);
+}
+
+koopa_raw_function_data_t *ir_mut(koopa_raw_function_t func){
+    return const_cast<koopa_raw_function_data_t *>(func);
+}
+
+koopa_raw_type_t ir_type_int32(){
+    static koopa_raw_type_kind_t ty = {KOOPA_RTT_INT32, {}};
+    return &ty;
+}
+
+koopa_raw_type_t ir_type_unit(){
+    static koopa_raw_type_kind_t ty = {KOOPA_RTT_UNIT, {}};
+    return &ty;
+}
+
+koopa_raw_type_t ir_type_pointer(koopa_raw_type_t base){
+    static std::map<koopa_raw_type_t, koopa_raw_type_kind_t *> pointers;
+    auto &ty = pointers[base];
+    if(ty == nullptr){
+        ty = new koopa_raw_type_kind_t();
+        ty->tag = KOOPA_RTT_POINTER;
+        ty->data.pointer.base = base;
+    }
+    return ty;
+}
+
+koopa_raw_value_data_t *ir_new_value(koopa_raw_type_t ty, koopa_raw_value_tag_t tag){
+    auto value = new koopa_raw_value_data_t();
+    value->ty = ty;
+    value->name = nullptr;
+    value->used_by = ir_new_slice(std::vector<koopa_raw_value_t>());
+    value->kind.tag = tag;
+    return value;
+}
+
+koopa_raw_value_t ir_new_integer(int32_t value){
+    return ir_new_integer(value, ir_type_int32());
+}
+
+koopa_raw_value_t ir_new_integer(int32_t value, koopa_raw_type_t ty){
+    auto integer = ir_new_value(ty, KOOPA_RVT_INTEGER);
+    integer->kind.data.integer.value = value;
+    return integer;
+}
+
+koopa_raw_basic_block_data_t *ir_new_basic_block(const std::string &prefix){
+    auto bb = new koopa_raw_basic_block_data_t();
+    std::string name = "%" + prefix + "_opt_" + std::to_string(new_bb_id++);
+    bb->name = strdup(name.c_str());
+    bb->params = ir_new_slice(std::vector<koopa_raw_value_t>());
+    bb->used_by = ir_new_slice(std::vector<koopa_raw_value_t>());
+    bb->insts = ir_new_slice(std::vector<koopa_raw_value_t>());
+    return bb;
+}
+
+koopa_raw_value_data_t *ir_copy_inst(koopa_raw_value_t inst){
+    auto copy = ir_new_value(inst->ty, inst->kind.tag);
+    copy->name = inst->name;
+    copy->kind = inst->kind;
+    auto &kind = copy->kind;
+    switch (kind.tag)
+    {
+    case KOOPA_RVT_BRANCH:
+        kind.data.branch.true_args = ir_new_slice(ir_values(kind.data.branch.true_args));
+        kind.data.branch.false_args = ir_new_slice(ir_values(kind.data.branch.false_args));
+        break;
+    case KOOPA_RVT_JUMP:
+        kind.data.jump.args = ir_new_slice(ir_values(kind.data.jump.args));
+        break;
+    case KOOPA_RVT_CALL:
+        kind.data.call.args = ir_new_slice(ir_values(kind.data.call.args));
+        break;
+    default:
+        break;
+    }
+    return copy;
+}
+
+bool ir_is_integer(koopa_raw_value_t value){
+    return value->kind.tag == KOOPA_RVT_INTEGER;
+}
+
+bool ir_is_integer(koopa_raw_value_t value, int32_t number){
+    return ir_is_integer(value) && value->kind.data.integer.value == number;
+}
+
+/* Distinct integer objects with equal numbers are the same value */
+bool ir_same_value(koopa_raw_value_t a, koopa_raw_value_t b){
+    if(a == b){
+        return true;
+    }
+    return ir_is_integer(a) && ir_is_integer(b)
+        && a->kind.data.integer.value == b->kind.data.integer.value;
+}
+
+koopa_raw_value_t ir_split_offset(koopa_raw_value_t value, int32_t &offset){
+    offset = 0;
+    if(value->kind.tag != KOOPA_RVT_BINARY){
+        return value;
+    }
+    const auto &binary = value->kind.data.binary;
+    if(binary.op == KOOPA_RBO_ADD && ir_is_integer(binary.rhs)){
+        offset = binary.rhs->kind.data.integer.value;
+        return binary.lhs;
+    }
+    if(binary.op == KOOPA_RBO_ADD && ir_is_integer(binary.lhs)){
+        offset = binary.lhs->kind.data.integer.value;
+        return binary.rhs;
+    }
+    if(binary.op == KOOPA_RBO_SUB && ir_is_integer(binary.rhs)
+        && binary.rhs->kind.data.integer.value != INT32_MIN){
+        offset = -binary.rhs->kind.data.integer.value;
+        return binary.lhs;
+    }
+    return value;
+}
+
+bool ir_eval_binary(koopa_raw_binary_op_t op, int32_t lhs, int32_t rhs, int32_t &result){
+    /* wrap around like the hardware does */
+    uint32_t a = (uint32_t)lhs, b = (uint32_t)rhs;
+    switch (op)
+    {
+    case KOOPA_RBO_NOT_EQ:  result = (lhs != rhs);  break;
+    case KOOPA_RBO_EQ:      result = (lhs == rhs);  break;
+    case KOOPA_RBO_GT:      result = (lhs > rhs);   break;
+    case KOOPA_RBO_LT:      result = (lhs < rhs);   break;
+    case KOOPA_RBO_GE:      result = (lhs >= rhs);  break;
+    case KOOPA_RBO_LE:      result = (lhs <= rhs);  break;
+    case KOOPA_RBO_ADD:     result = (int32_t)(a + b);  break;
+    case KOOPA_RBO_SUB:     result = (int32_t)(a - b);  break;
+    case KOOPA_RBO_MUL:     result = (int32_t)(a * b);  break;
+    case KOOPA_RBO_DIV:
+        if(rhs == 0){
+            return false;
+        }
+        result = (lhs == INT32_MIN && rhs == -1) ? INT32_MIN : lhs / rhs;
+        break;
+    case KOOPA_RBO_MOD:
+        if(rhs == 0){
+            return false;
+        }
+        result = (lhs == INT32_MIN && rhs == -1) ? 0 : lhs % rhs;
+        break;
+    case KOOPA_RBO_AND:     result = (int32_t)(a & b);  break;
+    case KOOPA_RBO_OR:      result = (int32_t)(a | b);  break;
+    case KOOPA_RBO_XOR:     result = (int32_t)(a ^ b);  break;
+    case KOOPA_RBO_SHL:     result = (int32_t)(a << (b & 31));  break;
+    case KOOPA_RBO_SHR:     result = (int32_t)(a >> (b & 31));  break;
+    case KOOPA_RBO_SAR:     result = lhs >> (b & 31);   break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+koopa_raw_slice_t ir_new_slice(const std::vector<koopa_raw_value_t> &values){
+    koopa_raw_slice_t slice;
+    slice.kind = KOOPA_RSIK_VALUE;
+    slice.len = values.size();
+    slice.buffer = new const void *[values.size() + 1];
+    for(size_t i = 0; i < values.size(); ++i){
+        slice.buffer[i] = values[i];
+    }
+    return slice;
+}
+
+koopa_raw_slice_t ir_new_slice(const std::vector<koopa_raw_basic_block_t> &bbs){
+    koopa_raw_slice_t slice;
+    slice.kind = KOOPA_RSIK_BASIC_BLOCK;
+    slice.len = bbs.size();
+    slice.buffer = new const void *[bbs.size() + 1];
+    for(size_t i = 0; i < bbs.size(); ++i){
+        slice.buffer[i] = bbs[i];
+    }
+    return slice;
+}
+
+std::vector<koopa_raw_value_t> ir_values(const koopa_raw_slice_t &slice){
+    std::vector<koopa_raw_value_t> values;
+    assert(slice.len == 0 || slice.kind == KOOPA_RSIK_VALUE);
+    for(size_t i = 0; i < slice.len; ++i){
+        values.push_back(reinterpret_cast<koopa_raw_value_t>(slice.buffer[i]));
+    }
+    return values;
+}
+
+std::vector<koopa_raw_basic_block_t> ir_basic_blocks(const koopa_raw_function_t &func){
+    std::vector<koopa_raw_basic_block_t> bbs;
+    assert(func->bbs.len == 0 || func->bbs.kind == KOOPA_RSIK_BASIC_BLOCK);
+    for(size_t i = 0; i < func->bbs.len; ++i){
+        bbs.push_back(reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]));
+    }
+    return bbs;
+}
+
+void ir_set_insts(koopa_raw_basic_block_t bb, const std::vector<koopa_raw_value_t> &insts){
+    ir_mut(bb)->insts = ir_new_slice(insts);
+}
+
+void ir_set_params(koopa_raw_basic_block_t bb, const std::vector<koopa_raw_value_t> &params){
+    for(size_t i = 0; i < params.size(); ++i){
+        assert(params[i]->kind.tag == KOOPA_RVT_BLOCK_ARG_REF);
+        ir_mut(params[i])->kind.data.block_arg_ref.index = i;
+    }
+    ir_mut(bb)->params = ir_new_slice(params);
+}
+
+void ir_set_basic_blocks(koopa_raw_function_t func, const std::vector<koopa_raw_basic_block_t> &bbs){
+    ir_mut(func)->bbs = ir_new_slice(bbs);
+}
+
+bool ir_is_terminator(koopa_raw_value_t inst){
+    switch (inst->kind.tag)
+    {
+    case KOOPA_RVT_BRANCH:
+    case KOOPA_RVT_JUMP:
+    case KOOPA_RVT_RETURN:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Instructions that must stay even if their result is unused */
+bool ir_has_side_effect(koopa_raw_value_t inst){
+    switch (inst->kind.tag)
+    {
+    case KOOPA_RVT_STORE:
+    case KOOPA_RVT_CALL:
+    case KOOPA_RVT_BRANCH:
+    case KOOPA_RVT_JUMP:
+    case KOOPA_RVT_RETURN:
+        return true;
+    default:
+        return false;
+    }
+}
+
+koopa_raw_value_t ir_terminator(koopa_raw_basic_block_t bb){
+    assert(bb->insts.len > 0);
+    auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+    assert(ir_is_terminator(inst));
+    return inst;
+}
+
+koopa_raw_value_t ir_new_jump(koopa_raw_basic_block_t target,
+        const std::vector<koopa_raw_value_t> &args){
+    auto jump = ir_new_value(ir_type_unit(), KOOPA_RVT_JUMP);
+    jump->kind.data.jump.target = target;
+    jump->kind.data.jump.args = ir_new_slice(args);
+    return jump;
+}
+
+koopa_raw_value_t ir_new_branch(koopa_raw_value_t cond,
+        koopa_raw_basic_block_t true_bb, const std::vector<koopa_raw_value_t> &true_args,
+        koopa_raw_basic_block_t false_bb, const std::vector<koopa_raw_value_t> &false_args){
+    auto branch = ir_new_value(ir_type_unit(), KOOPA_RVT_BRANCH);
+    branch->kind.data.branch.cond = cond;
+    branch->kind.data.branch.true_bb = true_bb;
+    branch->kind.data.branch.true_args = ir_new_slice(true_args);
+    branch->kind.data.branch.false_bb = false_bb;
+    branch->kind.data.branch.false_args = ir_new_slice(false_args);
+    return branch;
+}
+
+koopa_raw_value_t ir_new_binary(koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs){
+    auto binary = ir_new_value(ir_type_int32(), KOOPA_RVT_BINARY);
+    binary->kind.data.binary.op = op;
+    binary->kind.data.binary.lhs = lhs;
+    binary->kind.data.binary.rhs = rhs;
+    return binary;
+}
+
+koopa_raw_value_t ir_new_alloc(koopa_raw_type_t base){
+    return ir_new_value(ir_type_pointer(base), KOOPA_RVT_ALLOC);
+}
+
+koopa_raw_value_t ir_new_load(koopa_raw_value_t src){
+    auto load = ir_new_value(src->ty->data.pointer.base, KOOPA_RVT_LOAD);
+    load->kind.data.load.src = src;
+    return load;
+}
+
+koopa_raw_value_t ir_new_store(koopa_raw_value_t value, koopa_raw_value_t dest){
+    auto store = ir_new_value(ir_type_unit(), KOOPA_RVT_STORE);
+    store->kind.data.store.value = value;
+    store->kind.data.store.dest = dest;
+    return store;
+}
+
+std::vector<koopa_raw_basic_block_t> ir_successors(koopa_raw_basic_block_t bb){
+    std::vector<koopa_raw_basic_block_t> succs;
+    auto term = ir_terminator(bb);
+    if(term->kind.tag == KOOPA_RVT_BRANCH){
+        succs.push_back(term->kind.data.branch.true_bb);
+        if(term->kind.data.branch.false_bb != term->kind.data.branch.true_bb){
+            succs.push_back(term->kind.data.branch.false_bb);
+        }
+    }
+    else if(term->kind.tag == KOOPA_RVT_JUMP){
+        succs.push_back(term->kind.data.jump.target);
+    }
+    return succs;
+}
+
+std::vector<koopa_raw_value_t> ir_operands(koopa_raw_value_t inst){
+    std::vector<koopa_raw_value_t> operands;
+    ir_rewrite_operands(inst, [&](koopa_raw_value_t v){
+        operands.push_back(v);
+        return v;
+    });
+    return operands;
+}
+
+static void rewrite_slice(koopa_raw_slice_t &slice,
+        const std::function<koopa_raw_value_t(koopa_raw_value_t)> &fn){
+    for(size_t i = 0; i < slice.len; ++i){
+        slice.buffer[i] = fn(reinterpret_cast<koopa_raw_value_t>(slice.buffer[i]));
+    }
+}
+
+/* Calls `fn` on every value operand and stores back what it returns */
+void ir_rewrite_operands(koopa_raw_value_t inst,
+        const std::function<koopa_raw_value_t(koopa_raw_value_t)> &fn){
+    auto &kind = ir_mut(inst)->kind;
+    switch (kind.tag)
+    {
+    case KOOPA_RVT_LOAD:
+        kind.data.load.src = fn(kind.data.load.src);
+        break;
+    case KOOPA_RVT_STORE:
+        kind.data.store.value = fn(kind.data.store.value);
+        kind.data.store.dest = fn(kind.data.store.dest);
+        break;
+    case KOOPA_RVT_GET_PTR:
+        kind.data.get_ptr.src = fn(kind.data.get_ptr.src);
+        kind.data.get_ptr.index = fn(kind.data.get_ptr.index);
+        break;
+    case KOOPA_RVT_GET_ELEM_PTR:
+        kind.data.get_elem_ptr.src = fn(kind.data.get_elem_ptr.src);
+        kind.data.get_elem_ptr.index = fn(kind.data.get_elem_ptr.index);
+        break;
+    case KOOPA_RVT_BINARY:
+        kind.data.binary.lhs = fn(kind.data.binary.lhs);
+        kind.data.binary.rhs = fn(kind.data.binary.rhs);
+        break;
+    case KOOPA_RVT_BRANCH:
+        kind.data.branch.cond = fn(kind.data.branch.cond);
+        rewrite_slice(kind.data.branch.true_args, fn);
+        rewrite_slice(kind.data.branch.false_args, fn);
+        break;
+    case KOOPA_RVT_JUMP:
+        rewrite_slice(kind.data.jump.args, fn);
+        break;
+    case KOOPA_RVT_CALL:
+        rewrite_slice(kind.data.call.args, fn);
+        break;
+    case KOOPA_RVT_RETURN:
+        if(kind.data.ret.value != nullptr){
+            kind.data.ret.value = fn(kind.data.ret.value);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Replace every use of a key of `repl` with its value, following chains */
+void ir_replace_uses(const koopa_raw_function_t &func, const value_map_t &repl){
+    if(repl.empty()){
+        return;
+    }
+    auto resolve = [&](koopa_raw_value_t v){
+        auto it = repl.find(v);
+        while(it != repl.end()){
+            v = it->second;
+            it = repl.find(v);
+        }
+        return v;
+    };
+    for(auto bb : ir_basic_blocks(func)){
+        for(auto inst : ir_values(bb->insts)){
+            ir_rewrite_operands(inst, resolve);
+        }
+    }
+}
+
+void ir_append_edge_args(koopa_raw_basic_block_t bb, koopa_raw_basic_block_t target,
+        const std::vector<koopa_raw_value_t> &args){
+    auto &kind = ir_mut(ir_terminator(bb))->kind;
+    auto append = [&](koopa_raw_slice_t &slice){
+        auto values = ir_values(slice);
+        values.insert(values.end(), args.begin(), args.end());
+        slice = ir_new_slice(values);
+    };
+    if(kind.tag == KOOPA_RVT_JUMP){
+        assert(kind.data.jump.target == target);
+        append(kind.data.jump.args);
+    }
+    else{
+        assert(kind.tag == KOOPA_RVT_BRANCH);
+        if(kind.data.branch.true_bb == target){
+            append(kind.data.branch.true_args);
+        }
+        if(kind.data.branch.false_bb == target){
+            append(kind.data.branch.false_args);
+        }
+    }
+}
+
+/* Drop parameter `index` of `bb` together with the matching argument of every incoming edge */
+void ir_remove_block_param(const koopa_raw_function_t &func,
+        koopa_raw_basic_block_t bb, size_t index){
+    auto erase = [&](koopa_raw_slice_t &slice){
+        auto values = ir_values(slice);
+        assert(index < values.size());
+        values.erase(values.begin() + index);
+        slice = ir_new_slice(values);
+    };
+    for(auto pred : ir_basic_blocks(func)){
+        auto &kind = ir_mut(ir_terminator(pred))->kind;
+        if(kind.tag == KOOPA_RVT_JUMP && kind.data.jump.target == bb){
+            erase(kind.data.jump.args);
+        }
+        else if(kind.tag == KOOPA_RVT_BRANCH){
+            if(kind.data.branch.true_bb == bb){
+                erase(kind.data.branch.true_args);
+            }
+            if(kind.data.branch.false_bb == bb){
+                erase(kind.data.branch.false_args);
+            }
+        }
+    }
+    auto params = ir_values(bb->params);
+    params.erase(params.begin() + index);
+    ir_set_params(bb, params);
+}
+
+void ir_remove_unreachable_blocks(const koopa_raw_function_t &func){
+    auto bbs = ir_basic_blocks(func);
+    if(bbs.empty()){
+        return;
+    }
+
+    std::set<koopa_raw_basic_block_t> reachable;
+    std::vector<koopa_raw_basic_block_t> worklist = {bbs[0]};
+    reachable.insert(bbs[0]);
+    while(!worklist.empty()){
+        auto bb = worklist.back();
+        worklist.pop_back();
+        for(auto succ : ir_successors(bb)){
+            if(reachable.insert(succ).second){
+                worklist.push_back(succ);
+            }
+        }
+    }
+
+    std::vector<koopa_raw_basic_block_t> kept;
+    for(auto bb : bbs){
+        if(reachable.count(bb)){
+            kept.push_back(bb);
+        }
+    }
+    if(kept.size() != bbs.size()){
+        ir_set_basic_blocks(func, kept);
+    }
+}
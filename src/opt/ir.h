@@ -0,0 +1,88 @@
+#ifndef OPT_IR_H
+#define OPT_IR_H
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "koopa.h"
+
+/*
+    Helpers for rewriting the raw program built by libkoopa in place.
+
+    libkoopa hands out const pointers; the passes cast them back with
+    `ir_mut` and edit the data directly. Everything created here is owned
+    by the pass pipeline and lives until the compiler exits.
+
+    NOTE: `used_by` slices are NOT kept up to date by the passes; scan the
+    instructions (e.g. with `ir_operands`) when uses are needed.
+*/
+
+typedef std::map<koopa_raw_value_t, koopa_raw_value_t> value_map_t;
+
+koopa_raw_value_data_t *ir_mut(koopa_raw_value_t value);
+koopa_raw_basic_block_data_t *ir_mut(koopa_raw_basic_block_t bb);
+koopa_raw_function_data_t *ir_mut(koopa_raw_function_t func);
+
+/* Types */
+koopa_raw_type_t ir_type_int32();
+koopa_raw_type_t ir_type_unit();
+koopa_raw_type_t ir_type_pointer(koopa_raw_type_t base);
+
+/* Values and basic blocks */
+koopa_raw_value_data_t *ir_new_value(koopa_raw_type_t ty, koopa_raw_value_tag_t tag);
+koopa_raw_value_t ir_new_integer(int32_t value);
+koopa_raw_value_t ir_new_integer(int32_t value, koopa_raw_type_t ty);
+koopa_raw_basic_block_data_t *ir_new_basic_block(const std::string &prefix);
+
+/* A copy of `inst` with its own arg slices; operands and targets are shared */
+koopa_raw_value_data_t *ir_copy_inst(koopa_raw_value_t inst);
+
+bool ir_is_integer(koopa_raw_value_t value);
+bool ir_is_integer(koopa_raw_value_t value, int32_t number);
+bool ir_same_value(koopa_raw_value_t a, koopa_raw_value_t b);
+/* value == base + offset for a constant offset (`add`/`sub` of an integer); else base is value */
+koopa_raw_value_t ir_split_offset(koopa_raw_value_t value, int32_t &offset);
+/* Constant folding with RISCV semantics; false if the result is not a constant */
+bool ir_eval_binary(koopa_raw_binary_op_t op, int32_t lhs, int32_t rhs, int32_t &result);
+
+/* Slices */
+koopa_raw_slice_t ir_new_slice(const std::vector<koopa_raw_value_t> &values);
+koopa_raw_slice_t ir_new_slice(const std::vector<koopa_raw_basic_block_t> &bbs);
+std::vector<koopa_raw_value_t> ir_values(const koopa_raw_slice_t &slice);
+std::vector<koopa_raw_basic_block_t> ir_basic_blocks(const koopa_raw_function_t &func);
+
+void ir_set_insts(koopa_raw_basic_block_t bb, const std::vector<koopa_raw_value_t> &insts);
+void ir_set_params(koopa_raw_basic_block_t bb, const std::vector<koopa_raw_value_t> &params);
+void ir_set_basic_blocks(koopa_raw_function_t func, const std::vector<koopa_raw_basic_block_t> &bbs);
+
+/* Instructions */
+bool ir_is_terminator(koopa_raw_value_t inst);
+bool ir_has_side_effect(koopa_raw_value_t inst);
+koopa_raw_value_t ir_terminator(koopa_raw_basic_block_t bb);
+koopa_raw_value_t ir_new_jump(koopa_raw_basic_block_t target,
+        const std::vector<koopa_raw_value_t> &args);
+koopa_raw_value_t ir_new_branch(koopa_raw_value_t cond,
+        koopa_raw_basic_block_t true_bb, const std::vector<koopa_raw_value_t> &true_args,
+        koopa_raw_basic_block_t false_bb, const std::vector<koopa_raw_value_t> &false_args);
+koopa_raw_value_t ir_new_binary(koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs);
+koopa_raw_value_t ir_new_alloc(koopa_raw_type_t base);
+koopa_raw_value_t ir_new_load(koopa_raw_value_t src);
+koopa_raw_value_t ir_new_store(koopa_raw_value_t value, koopa_raw_value_t dest);
+std::vector<koopa_raw_basic_block_t> ir_successors(koopa_raw_basic_block_t bb);
+
+std::vector<koopa_raw_value_t> ir_operands(koopa_raw_value_t inst);
+void ir_rewrite_operands(koopa_raw_value_t inst,
+        const std::function<koopa_raw_value_t(koopa_raw_value_t)> &fn);
+void ir_replace_uses(const koopa_raw_function_t &func, const value_map_t &repl);
+
+/* Arguments passed along the edge bb -> target (both edges of a `br` if it targets `target` twice) */
+void ir_append_edge_args(koopa_raw_basic_block_t bb, koopa_raw_basic_block_t target,
+        const std::vector<koopa_raw_value_t> &args);
+void ir_remove_block_param(const koopa_raw_function_t &func,
+        koopa_raw_basic_block_t bb, size_t index);
+
+void ir_remove_unreachable_blocks(const koopa_raw_function_t &func);
+
+#endif /**< src/opt/ir.h */
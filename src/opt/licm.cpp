@@ -0,0 +1,151 @@
+#include "opt.h"
+#include "ir.h"
+#include "cfg.h"
+#include "alias.h"
+
+/*
+    Loop-invariant code motion.
+
+    Every loop gets a preheader first, then loops are visited innermost
+    first. A pure instruction (binary, getelemptr, getptr) whose operands
+    are all defined outside the loop moves to the preheader, which belongs
+    to the enclosing loop; from there it may move out again.
+
+    A load moves too when nothing in the loop may write its memory: no
+    call and no store that may alias it. A `while` body may not run at
+    all, so the load must also be harmless to run early: it sits in the
+    header, or it reads a named object at a constant in-bounds offset.
+*/
+
+typedef std::map<koopa_raw_value_t, koopa_raw_basic_block_t> block_map_t;
+
+typedef struct{
+    std::vector<koopa_raw_value_t> stores;
+    bool has_call;
+} loop_memory_t;
+
+static bool is_invariant(const loop_t &loop, const block_map_t &block_of,
+        koopa_raw_value_t value){
+    auto it = block_of.find(value);
+    return it == block_of.end() || loop.blocks.count(it->second) == 0;
+}
+
+/* Loading from `ptr` cannot fault, wherever it is done */
+static bool is_safe_address(koopa_raw_value_t ptr){
+    switch (ptr->kind.tag)
+    {
+    case KOOPA_RVT_ALLOC:
+    case KOOPA_RVT_GLOBAL_ALLOC:
+        return true;
+    case KOOPA_RVT_GET_ELEM_PTR:{
+        auto src = ptr->kind.data.get_elem_ptr.src;
+        auto index = ptr->kind.data.get_elem_ptr.index;
+        auto len = src->ty->data.pointer.base->data.array.len;
+        return ir_is_integer(index) && index->kind.data.integer.value >= 0
+            && (size_t)index->kind.data.integer.value < len && is_safe_address(src);
+    }
+    default:
+        return false;
+    }
+}
+
+static bool can_hoist(const loop_t &loop, const block_map_t &block_of, const alias_info_t &alias,
+        const loop_memory_t &memory, koopa_raw_basic_block_t bb, koopa_raw_value_t inst){
+    switch (inst->kind.tag)
+    {
+    case KOOPA_RVT_BINARY:
+    case KOOPA_RVT_GET_ELEM_PTR:
+    case KOOPA_RVT_GET_PTR:
+        break;
+    case KOOPA_RVT_LOAD:{
+        auto src = inst->kind.data.load.src;
+        if(memory.has_call || (bb != loop.header && !is_safe_address(src))){
+            return false;
+        }
+        for(auto dest : memory.stores){
+            if(alias_may_alias(alias, src, dest)){
+                return false;
+            }
+        }
+        break;
+    }
+    default:
+        return false;
+    }
+    for(auto operand : ir_operands(inst)){
+        if(!is_invariant(loop, block_of, operand)){
+            return false;
+        }
+    }
+    return true;
+}
+
+static void hoist_loop(const loop_t &loop, const bb_list_t &rpo, const alias_info_t &alias,
+        block_map_t &block_of){
+    loop_memory_t memory = {{}, false};
+    for(auto bb : loop.blocks){
+        for(auto inst : ir_values(bb->insts)){
+            if(inst->kind.tag == KOOPA_RVT_STORE){
+                memory.stores.push_back(inst->kind.data.store.dest);
+            }
+            else if(inst->kind.tag == KOOPA_RVT_CALL){
+                memory.has_call = true;
+            }
+        }
+    }
+
+    /* in RPO, the definitions of operands come before their uses */
+    std::vector<koopa_raw_value_t> hoisted;
+    for(auto bb : rpo){
+        if(loop.blocks.count(bb) == 0){
+            continue;
+        }
+        std::vector<koopa_raw_value_t> insts;
+        for(auto inst : ir_values(bb->insts)){
+            if(can_hoist(loop, block_of, alias, memory, bb, inst)){
+                hoisted.push_back(inst);
+                block_of[inst] = loop.preheader;
+                continue;
+            }
+            insts.push_back(inst);
+        }
+        if(insts.size() != bb->insts.len){
+            ir_set_insts(bb, insts);
+        }
+    }
+    if(hoisted.empty()){
+        return;
+    }
+
+    auto insts = ir_values(loop.preheader->insts);
+    insts.insert(insts.end() - 1, hoisted.begin(), hoisted.end());
+    ir_set_insts(loop.preheader, insts);
+}
+
+void opt_licm(const koopa_raw_function_t &func){
+    ir_remove_unreachable_blocks(func);
+    loops_insert_preheaders(func);
+
+    cfg_t cfg;
+    dom_tree_t dom;
+    std::vector<loop_t> loops;
+    cfg_build(func, cfg);
+    dom_tree_build(cfg, dom);
+    loops_build(cfg, dom, loops);
+
+    block_map_t block_of;
+    for(auto bb : cfg.rpo){
+        for(auto param : ir_values(bb->params)){
+            block_of[param] = bb;
+        }
+        for(auto inst : ir_values(bb->insts)){
+            block_of[inst] = bb;
+        }
+    }
+
+    alias_info_t alias;
+    alias_analyze(func, alias);
+    for(auto &loop : loops){
+        hoist_loop(loop, cfg.rpo, alias, block_of);
+    }
+}
@@ -0,0 +1,172 @@
+#include "opt.h"
+#include "ir.h"
+#include "cfg.h"
+#include "alias.h"
+
+/*
+    Store-to-load forwarding and redundant load elimination.
+
+    A forward dataflow over the CFG finds, at every point, which pointers
+    hold a known value: the value last stored through the pointer, or
+    the result of an earlier load of it. A block starts with what all its
+    predecessors agree on (the same pointer with the same value). A store
+    kills the pointers that may alias its destination; a call kills those
+    it may write according to the callee's summary (`alias.h`). A load of
+    a pointer with a known value is replaced by that value. The pointers
+    are kept in an `alias_ptr_set_t`, so a store only looks at those it
+    may overlap.
+
+    A value known at a point was produced on every path to it, so it
+    dominates the load it replaces.
+*/
+
+typedef struct{
+    std::map<koopa_raw_value_t, koopa_raw_value_t> values;
+    alias_ptr_set_t ptrs;
+} memory_state_t;
+
+typedef struct{
+    bool reached;
+    memory_state_t out;
+} block_state_t;
+
+typedef struct{
+    const call_summaries_t *summaries;
+    alias_info_t alias;
+} load_elim_t;
+
+static void remember(memory_state_t &state, koopa_raw_value_t ptr, koopa_raw_value_t value){
+    state.values[ptr] = value;
+    alias_set_insert(state.ptrs, ptr);
+}
+
+static void forget(memory_state_t &state, koopa_raw_value_t ptr){
+    state.values.erase(ptr);
+    alias_set_erase(state.ptrs, ptr);
+}
+
+static void kill_aliases(const load_elim_t &le, memory_state_t &state, koopa_raw_value_t dest){
+    for(auto ptr : alias_set_may_alias(le.alias, state.ptrs, dest)){
+        forget(state, ptr);
+    }
+}
+
+static void kill_call(const load_elim_t &le, memory_state_t &state, koopa_raw_value_t call){
+    for(auto ptr : alias_set_call_may_modify(le.alias, *le.summaries, state.ptrs, call)){
+        forget(state, ptr);
+    }
+}
+
+/*
+    Runs `bb` from `state`. With `repl` given, known loads are recorded
+    in it and dropped from the block.
+*/
+static void transfer(const load_elim_t &le, koopa_raw_basic_block_t bb,
+        memory_state_t &state, value_map_t *repl){
+    std::vector<koopa_raw_value_t> insts;
+    for(auto inst : ir_values(bb->insts)){
+        if(inst->kind.tag == KOOPA_RVT_LOAD){
+            auto src = inst->kind.data.load.src;
+            auto it = state.values.find(src);
+            if(it != state.values.end()){
+                if(repl != nullptr){
+                    (*repl)[inst] = it->second;
+                    continue;
+                }
+            }
+            else{
+                remember(state, src, inst);
+            }
+        }
+        else if(inst->kind.tag == KOOPA_RVT_STORE){
+            auto dest = inst->kind.data.store.dest;
+            kill_aliases(le, state, dest);
+            remember(state, dest, inst->kind.data.store.value);
+        }
+        else if(inst->kind.tag == KOOPA_RVT_CALL){
+            kill_call(le, state, inst);
+        }
+        insts.push_back(inst);
+    }
+    if(repl != nullptr && insts.size() != bb->insts.len){
+        ir_set_insts(bb, insts);
+    }
+}
+
+/* What every reached predecessor of `bb` agrees on */
+static memory_state_t meet(const cfg_t &cfg, const std::map<koopa_raw_basic_block_t, block_state_t> &states,
+        koopa_raw_basic_block_t bb){
+    memory_state_t in;
+    bool first = true;
+    for(auto pred : cfg.preds.at(bb)){
+        const auto &pred_state = states.at(pred);
+        if(!pred_state.reached){
+            continue;
+        }
+        if(first){
+            in = pred_state.out;
+            first = false;
+            continue;
+        }
+        std::vector<koopa_raw_value_t> lost;
+        for(auto &known : in.values){
+            auto other = pred_state.out.values.find(known.first);
+            if(other == pred_state.out.values.end() || !ir_same_value(other->second, known.second)){
+                lost.push_back(known.first);
+            }
+        }
+        for(auto ptr : lost){
+            forget(in, ptr);
+        }
+    }
+    return in;
+}
+
+static void eliminate_loads(const koopa_raw_function_t &func, const call_summaries_t &summaries){
+    ir_remove_unreachable_blocks(func);
+
+    cfg_t cfg;
+    cfg_build(func, cfg);
+    load_elim_t le;
+    le.summaries = &summaries;
+    alias_analyze(func, le.alias);
+
+    /* unreached predecessors stand for "anything": the greatest fixed point */
+    std::map<koopa_raw_basic_block_t, block_state_t> states;
+    for(auto bb : cfg.rpo){
+        states[bb] = {false, {}};
+    }
+    bool changed = true;
+    while(changed){
+        changed = false;
+        for(auto bb : cfg.rpo){
+            auto state = (bb == cfg.rpo[0]) ? memory_state_t() : meet(cfg, states, bb);
+            transfer(le, bb, state, nullptr);
+            auto &bb_state = states[bb];
+            if(!bb_state.reached || bb_state.out.values != state.values){
+                bb_state = {true, state};
+                changed = true;
+            }
+        }
+    }
+
+    value_map_t repl;
+    for(auto bb : cfg.rpo){
+        auto state = (bb == cfg.rpo[0]) ? memory_state_t() : meet(cfg, states, bb);
+        transfer(le, bb, state, &repl);
+    }
+    if(!repl.empty()){
+        ir_replace_uses(func, repl);
+    }
+}
+
+void opt_load_elim(const koopa_raw_program_t &program){
+    call_summaries_t summaries;
+    alias_call_summaries(program, summaries);
+    for(size_t i = 0; i < program.funcs.len; ++i){
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if(func->bbs.len > 0){
+            eliminate_loads(func, summaries);
+        }
+    }
+}
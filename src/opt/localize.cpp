@@ -0,0 +1,175 @@
+#include "opt.h"
+#include "ir.h"
+#include "cfg.h"
+
+#include <cstring>
+#include <set>
+
+/*
+    Localisation of globals used by a single function.
+
+    A function runs at most once when it is `main` and nothing calls it,
+    or when it has a single call site, outside any loop, in a function
+    that runs at most once. Only functions reachable from `main` count,
+    so the bodies left behind by the inliner do not keep a global shared.
+
+    A global `i32` that only such a function uses is its own variable:
+    it becomes an `alloc` in the entry, which starts with a store of the
+    initial value, and mem2reg turns it into SSA values. The global stays
+    in place for the bodies no longer called.
+
+    A global array stays in memory, but its address is taken once in the
+    entry (`getptr @arr, 0`) and kept in a register, rather than built
+    with `la` wherever it is used.
+*/
+
+typedef std::map<koopa_raw_function_t, std::vector<koopa_raw_value_t> > call_sites_t;
+
+typedef struct{
+    koopa_raw_function_t main;
+    std::set<koopa_raw_function_t> reachable;
+    call_sites_t call_sites;                                  /* from reachable functions */
+    std::map<koopa_raw_value_t, koopa_raw_function_t> caller;
+    std::map<koopa_raw_value_t, koopa_raw_basic_block_t> call_block;
+    std::map<koopa_raw_function_t, bool> once;
+} localizer_t;
+
+static void mark_reachable(localizer_t &lo, koopa_raw_function_t func){
+    if(func->bbs.len == 0 || !lo.reachable.insert(func).second){
+        return;
+    }
+    for(auto bb : ir_basic_blocks(func)){
+        for(auto inst : ir_values(bb->insts)){
+            if(inst->kind.tag == KOOPA_RVT_CALL){
+                auto callee = inst->kind.data.call.callee;
+                lo.call_sites[callee].push_back(inst);
+                lo.caller[inst] = func;
+                lo.call_block[inst] = bb;
+                mark_reachable(lo, callee);
+            }
+        }
+    }
+}
+
+static bool in_loop(const koopa_raw_function_t &func, koopa_raw_basic_block_t bb){
+    cfg_t cfg;
+    dom_tree_t dom;
+    std::vector<loop_t> loops;
+    cfg_build(func, cfg);
+    dom_tree_build(cfg, dom);
+    loops_build(cfg, dom, loops);
+    for(auto &loop : loops){
+        if(loop.blocks.count(bb)){
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Whether `func` runs at most once; a function on a call cycle never does */
+static bool runs_once(localizer_t &lo, koopa_raw_function_t func){
+    auto it = lo.once.find(func);
+    if(it != lo.once.end()){
+        return it->second;
+    }
+    /* assumed false while the callers are looked at */
+    lo.once[func] = false;
+    const auto &sites = lo.call_sites[func];
+    bool once;
+    if(func == lo.main){
+        once = sites.empty();
+    }
+    else if(sites.size() == 1){
+        auto caller = lo.caller[sites[0]];
+        once = runs_once(lo, caller) && !in_loop(caller, lo.call_block[sites[0]]);
+    }
+    else{
+        once = false;
+    }
+    lo.once[func] = once;
+    return once;
+}
+
+/* The entry is run again when a block jumps back to it */
+static bool entry_reentered(const koopa_raw_function_t &func){
+    cfg_t cfg;
+    cfg_build(func, cfg);
+    return !cfg.preds.at(cfg.rpo[0]).empty();
+}
+
+/* Reachable function using each global, or null when several do */
+static std::map<koopa_raw_value_t, koopa_raw_function_t> find_owners(const localizer_t &lo){
+    std::map<koopa_raw_value_t, koopa_raw_function_t> owner;
+    for(auto func : lo.reachable){
+        for(auto bb : ir_basic_blocks(func)){
+            for(auto inst : ir_values(bb->insts)){
+                for(auto operand : ir_operands(inst)){
+                    if(operand->kind.tag != KOOPA_RVT_GLOBAL_ALLOC){
+                        continue;
+                    }
+                    auto it = owner.find(operand);
+                    if(it == owner.end()){
+                        owner[operand] = func;
+                    }
+                    else if(it->second != func){
+                        it->second = nullptr;
+                    }
+                }
+            }
+        }
+    }
+    return owner;
+}
+
+/* The new values for `global` at the front of the entry, and what replaces it */
+static koopa_raw_value_t localize(koopa_raw_value_t global, std::vector<koopa_raw_value_t> &front){
+    auto base = global->ty->data.pointer.base;
+    if(base->tag == KOOPA_RTT_INT32){
+        auto init = global->kind.data.global_alloc.init;
+        auto value = (init->kind.tag == KOOPA_RVT_INTEGER) ? init : ir_new_integer(0);
+        auto local = ir_new_alloc(ir_type_int32());
+        front.insert(front.begin(), local);
+        front.push_back(ir_new_store(value, local));
+        return local;
+    }
+    auto addr = ir_new_value(global->ty, KOOPA_RVT_GET_PTR);
+    addr->kind.data.get_ptr.src = global;
+    addr->kind.data.get_ptr.index = ir_new_integer(0);
+    front.push_back(addr);
+    return addr;
+}
+
+void opt_localize_globals(const koopa_raw_program_t &program){
+    localizer_t lo;
+    lo.main = nullptr;
+    for(size_t i = 0; i < program.funcs.len; ++i){
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if(strcmp(func->name, "@main") == 0){
+            lo.main = func;
+        }
+    }
+    if(lo.main == nullptr){
+        return;
+    }
+    mark_reachable(lo, lo.main);
+
+    std::map<koopa_raw_function_t, value_map_t> repl;
+    std::map<koopa_raw_function_t, std::vector<koopa_raw_value_t> > fronts;
+    for(auto &owner : find_owners(lo)){
+        auto func = owner.second;
+        if(func != nullptr && runs_once(lo, func) && !entry_reentered(func)){
+            repl[func][owner.first] = localize(owner.first, fronts[func]);
+        }
+    }
+    for(auto &entry : repl){
+        auto func = entry.first;
+        ir_replace_uses(func, entry.second);
+
+        auto bb = ir_basic_blocks(func)[0];
+        auto insts = fronts[func];
+        auto rest = ir_values(bb->insts);
+        insts.insert(insts.end(), rest.begin(), rest.end());
+        ir_set_insts(bb, insts);
+        opt_mem2reg(func);
+    }
+}
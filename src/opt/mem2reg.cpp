@@ -0,0 +1,310 @@
+#include "opt.h"
+#include "ir.h"
+#include "cfg.h"
+
+#include <cassert>
+#include <cstring>
+#include <set>
+#include <string>
+
+/*
+    SSA construction (Cytron et al.) for scalar `alloc`s.
+
+    An alloc is promoted if its address never escapes, i.e. it is only
+    used as the source of `load` and the destination of `store`. This
+    covers `alloc i32` locals, the copies of scalar parameters, the
+    short-circuit temporaries and the pointer copies of array parameters.
+    Phi nodes are Koopa block parameters, placed on the iterated dominance
+    frontier of the stores where the variable is live-in (pruned SSA).
+*/
+
+typedef std::map<koopa_raw_value_t, int> alloc_index_t;
+
+typedef struct{
+    std::vector<koopa_raw_value_t> allocs;
+    alloc_index_t index;
+    /* block -> (alloc index, block parameter) */
+    std::map<koopa_raw_basic_block_t, std::vector<std::pair<int, koopa_raw_value_t> > > phis;
+    std::map<std::pair<koopa_raw_basic_block_t, koopa_raw_basic_block_t>,
+             std::vector<koopa_raw_value_t> > edge_args;
+    value_map_t repl;
+    std::set<koopa_raw_value_t> dead;
+} mem2reg_t;
+
+static bool is_promotable_type(koopa_raw_type_t ty){
+    return ty->tag == KOOPA_RTT_INT32 || ty->tag == KOOPA_RTT_POINTER;
+}
+
+static void find_promotable_allocs(const koopa_raw_function_t &func, mem2reg_t &m){
+    std::vector<koopa_raw_value_t> candidates;
+    std::set<koopa_raw_value_t> escaped;
+    for(auto bb : ir_basic_blocks(func)){
+        for(auto inst : ir_values(bb->insts)){
+            if(inst->kind.tag == KOOPA_RVT_ALLOC
+                && is_promotable_type(inst->ty->data.pointer.base)){
+                candidates.push_back(inst);
+            }
+            else if(inst->kind.tag == KOOPA_RVT_LOAD){
+                /* the only fine use */
+            }
+            else if(inst->kind.tag == KOOPA_RVT_STORE){
+                escaped.insert(inst->kind.data.store.value);
+            }
+            else{
+                for(auto operand : ir_operands(inst)){
+                    escaped.insert(operand);
+                }
+            }
+        }
+    }
+    for(auto alloc : candidates){
+        if(escaped.count(alloc) == 0){
+            m.index[alloc] = m.allocs.size();
+            m.allocs.push_back(alloc);
+        }
+    }
+}
+
+static int promoted_load(const mem2reg_t &m, koopa_raw_value_t inst){
+    if(inst->kind.tag != KOOPA_RVT_LOAD){
+        return -1;
+    }
+    auto it = m.index.find(inst->kind.data.load.src);
+    return (it == m.index.end()) ? -1 : it->second;
+}
+
+static int promoted_store(const mem2reg_t &m, koopa_raw_value_t inst){
+    if(inst->kind.tag != KOOPA_RVT_STORE){
+        return -1;
+    }
+    auto it = m.index.find(inst->kind.data.store.dest);
+    return (it == m.index.end()) ? -1 : it->second;
+}
+
+static void place_phis(const cfg_t &cfg, const dom_tree_t &dom, mem2reg_t &m){
+    size_t n = m.allocs.size();
+    std::vector<std::set<koopa_raw_basic_block_t> > def_blocks(n), live_in(n);
+    std::vector<bb_list_t> upward_exposed(n);
+
+    for(auto bb : cfg.rpo){
+        std::set<int> defined;
+        for(auto inst : ir_values(bb->insts)){
+            int k = promoted_load(m, inst);
+            if(k >= 0 && defined.count(k) == 0){
+                upward_exposed[k].push_back(bb);
+            }
+            k = promoted_store(m, inst);
+            if(k >= 0){
+                defined.insert(k);
+                def_blocks[k].insert(bb);
+            }
+        }
+    }
+
+    for(size_t k = 0; k < n; ++k){
+        /* liveness: a block is live-in if it may read the variable before writing it */
+        bb_list_t worklist = upward_exposed[k];
+        for(auto bb : worklist){
+            live_in[k].insert(bb);
+        }
+        while(!worklist.empty()){
+            auto bb = worklist.back();
+            worklist.pop_back();
+            for(auto pred : cfg.preds.at(bb)){
+                if(def_blocks[k].count(pred) == 0 && live_in[k].insert(pred).second){
+                    worklist.push_back(pred);
+                }
+            }
+        }
+
+        /* iterated dominance frontier */
+        std::set<koopa_raw_basic_block_t> has_phi;
+        bb_list_t defs(def_blocks[k].begin(), def_blocks[k].end());
+        while(!defs.empty()){
+            auto bb = defs.back();
+            defs.pop_back();
+            for(auto df : dom.frontier.at(bb)){
+                if(has_phi.count(df) || live_in[k].count(df) == 0){
+                    continue;
+                }
+                has_phi.insert(df);
+
+                auto alloc = m.allocs[k];
+                auto param = ir_new_value(alloc->ty->data.pointer.base, KOOPA_RVT_BLOCK_ARG_REF);
+                if(alloc->name != nullptr){
+                    std::string name = "%" + std::string(alloc->name + 1) + "_"
+                                    + std::string(df->name + 1);
+                    param->name = strdup(name.c_str());
+                }
+                m.phis[df].push_back({(int)k, param});
+
+                if(def_blocks[k].count(df) == 0){
+                    defs.push_back(df);
+                }
+            }
+        }
+    }
+
+    for(auto &entry : m.phis){
+        auto params = ir_values(entry.first->params);
+        for(auto &phi : entry.second){
+            params.push_back(phi.second);
+        }
+        ir_set_params(entry.first, params);
+    }
+}
+
+static koopa_raw_value_t resolve(const mem2reg_t &m, koopa_raw_value_t value){
+    auto it = m.repl.find(value);
+    while(it != m.repl.end()){
+        value = it->second;
+        it = m.repl.find(value);
+    }
+    return value;
+}
+
+static koopa_raw_value_t undef_value(const mem2reg_t &m, int k){
+    /* reading an uninitialized variable; any value will do */
+    return ir_new_integer(0, m.allocs[k]->ty->data.pointer.base);
+}
+
+static void rename(const cfg_t &cfg, const dom_tree_t &dom, mem2reg_t &m,
+        koopa_raw_basic_block_t bb, std::vector<koopa_raw_value_t> cur){
+    auto it_phis = m.phis.find(bb);
+    if(it_phis != m.phis.end()){
+        for(auto &phi : it_phis->second){
+            cur[phi.first] = phi.second;
+        }
+    }
+
+    for(auto inst : ir_values(bb->insts)){
+        int k = promoted_load(m, inst);
+        if(k >= 0){
+            if(cur[k] == nullptr){
+                cur[k] = undef_value(m, k);
+            }
+            m.repl[inst] = cur[k];
+            m.dead.insert(inst);
+            continue;
+        }
+        k = promoted_store(m, inst);
+        if(k >= 0){
+            cur[k] = resolve(m, inst->kind.data.store.value);
+            m.dead.insert(inst);
+        }
+    }
+
+    for(auto succ : cfg.succs.at(bb)){
+        auto it = m.phis.find(succ);
+        if(it == m.phis.end()){
+            continue;
+        }
+        auto &args = m.edge_args[{bb, succ}];
+        for(auto &phi : it->second){
+            int k = phi.first;
+            args.push_back(cur[k] == nullptr ? undef_value(m, k) : resolve(m, cur[k]));
+        }
+    }
+
+    for(auto child : dom.children.at(bb)){
+        rename(cfg, dom, m, child, cur);
+    }
+}
+
+/* Parameters whose incoming arguments are all the same value (or itself) */
+static bool remove_trivial_params(const koopa_raw_function_t &func){
+    std::map<koopa_raw_basic_block_t, std::vector<std::vector<koopa_raw_value_t> > > incoming;
+    for(auto bb : ir_basic_blocks(func)){
+        auto &kind = ir_terminator(bb)->kind;
+        if(kind.tag == KOOPA_RVT_JUMP){
+            incoming[kind.data.jump.target].push_back(ir_values(kind.data.jump.args));
+        }
+        else if(kind.tag == KOOPA_RVT_BRANCH){
+            incoming[kind.data.branch.true_bb].push_back(ir_values(kind.data.branch.true_args));
+            incoming[kind.data.branch.false_bb].push_back(ir_values(kind.data.branch.false_args));
+        }
+    }
+
+    /* `incoming` is not updated while removing; look through `removed` instead */
+    value_map_t removed;
+    auto current = [&](koopa_raw_value_t v){
+        auto it = removed.find(v);
+        while(it != removed.end()){
+            v = it->second;
+            it = removed.find(v);
+        }
+        return v;
+    };
+
+    bool changed = false;
+    for(auto bb : ir_basic_blocks(func)){
+        auto params = ir_values(bb->params);
+        for(size_t i = params.size(); i-- > 0;){
+            koopa_raw_value_t same = nullptr;
+            bool trivial = true;
+            for(auto &args : incoming[bb]){
+                auto arg = current(args[i]);
+                if(arg == params[i] || (same != nullptr && ir_same_value(arg, same))){
+                    continue;
+                }
+                if(same != nullptr){
+                    trivial = false;
+                    break;
+                }
+                same = arg;
+            }
+            if(!trivial || same == nullptr){
+                continue;
+            }
+            removed[params[i]] = same;
+            ir_replace_uses(func, {{params[i], same}});
+            ir_remove_block_param(func, bb, i);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void opt_mem2reg(const koopa_raw_function_t &func){
+    if(func->bbs.len == 0){
+        return;
+    }
+
+    ir_remove_unreachable_blocks(func);
+
+    mem2reg_t m;
+    find_promotable_allocs(func, m);
+    if(m.allocs.empty()){
+        return;
+    }
+
+    cfg_t cfg;
+    dom_tree_t dom;
+    cfg_build(func, cfg);
+    dom_tree_build(cfg, dom);
+
+    place_phis(cfg, dom, m);
+    rename(cfg, dom, m, cfg.rpo[0],
+            std::vector<koopa_raw_value_t>(m.allocs.size(), nullptr));
+
+    for(auto &edge : m.edge_args){
+        ir_append_edge_args(edge.first.first, edge.first.second, edge.second);
+    }
+
+    for(auto alloc : m.allocs){
+        m.dead.insert(alloc);
+    }
+    for(auto bb : cfg.rpo){
+        std::vector<koopa_raw_value_t> insts;
+        for(auto inst : ir_values(bb->insts)){
+            if(m.dead.count(inst) == 0){
+                insts.push_back(inst);
+            }
+        }
+        ir_set_insts(bb, insts);
+    }
+    ir_replace_uses(func, m.repl);
+
+    while(remove_trivial_params(func)){
+    }
+}
@@ -0,0 +1,47 @@
+#include "opt.h"
+#include "ir.h"
+#include "alias.h"
+
+typedef void (*function_pass_t)(const koopa_raw_function_t &func);
+
+/* Run `pass` on every function with a body */
+static void run_on_functions(const koopa_raw_program_t &program, function_pass_t pass){
+    for(size_t i = 0; i < program.funcs.len; ++i){
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if(func->bbs.len == 0){
+            continue;
+        }
+        pass(func);
+    }
+}
+
+void opt_program(const koopa_raw_program_t &program){
+    run_on_functions(program, opt_mem2reg);
+    /* after mem2reg, so bodies are measured and copied in SSA form */
+    opt_inline(program);
+    run_on_functions(program, opt_tail_recursion);
+    /* after inlining, which leaves fewer functions sharing a global */
+    opt_localize_globals(program);
+    opt_sccp(program);
+    run_on_functions(program, opt_gvn);
+    /* call summaries need the whole program */
+    opt_load_elim(program);
+    /* forwarded loads leave stores nothing reads */
+    opt_dse(program);
+    opt_promote_globals(program);
+    run_on_functions(program, opt_licm);
+    /* hoisted code may now repeat what dominates the preheader */
+    run_on_functions(program, opt_gvn);
+    /* fully unrolled loops leave constants to fold and tests to decide */
+    run_on_functions(program, opt_unroll);
+    opt_sccp(program);
+    run_on_functions(program, opt_strength_reduce);
+    run_on_functions(program, opt_adce);
+    run_on_functions(program, opt_simplify_cfg);
+}
+
+void opt_dump_alias(const koopa_raw_program_t &program){
+    run_on_functions(program, opt_mem2reg);
+    run_on_functions(program, opt_gvn);
+    run_on_functions(program, alias_dump);
+}
@@ -0,0 +1,29 @@
+#ifndef OPT_OPT_H
+#define OPT_OPT_H
+
+#include "koopa.h"
+
+/* Optimize the raw program in place before RISCV generation */
+void opt_program(const koopa_raw_program_t &program);
+/* Print the alias analysis of every function, after mem2reg and GVN */
+void opt_dump_alias(const koopa_raw_program_t &program);
+
+/* Function passes */
+void opt_mem2reg(const koopa_raw_function_t &func);
+void opt_adce(const koopa_raw_function_t &func);
+void opt_simplify_cfg(const koopa_raw_function_t &func);
+void opt_gvn(const koopa_raw_function_t &func);
+void opt_licm(const koopa_raw_function_t &func);
+void opt_strength_reduce(const koopa_raw_function_t &func);
+void opt_tail_recursion(const koopa_raw_function_t &func);
+void opt_unroll(const koopa_raw_function_t &func);
+
+/* Program passes (they look at globals or across functions) */
+void opt_sccp(const koopa_raw_program_t &program);
+void opt_inline(const koopa_raw_program_t &program);
+void opt_load_elim(const koopa_raw_program_t &program);
+void opt_dse(const koopa_raw_program_t &program);
+void opt_promote_globals(const koopa_raw_program_t &program);
+void opt_localize_globals(const koopa_raw_program_t &program);
+
+#endif /**< src/opt/opt.h */
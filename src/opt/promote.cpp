@@ -0,0 +1,197 @@
+#include "opt.h"
+#include "ir.h"
+#include "cfg.h"
+#include "alias.h"
+
+#include <algorithm>
+
+/*
+    Scalar promotion of globals in loops.
+
+    A global `i32` accessed in a loop where nothing else may touch it (no
+    load or store that may alias it, no call that may read or write it,
+    by the `alias.h` summaries) is kept in a local instead: the preheader
+    copies the global into a new `alloc`, the loop uses the copy, and when
+    the loop stores to it, every exit (including a `ret` inside the loop)
+    copies it back, on a block of its own for an exit edge. mem2reg then
+    turns the copy into SSA values.
+
+    Loops are visited outermost first; the accesses of a promoted global
+    are gone from the inner loops by the time they are looked at.
+*/
+
+typedef struct{
+    const call_summaries_t *summaries;
+    alias_info_t alias;
+} promote_t;
+
+static bool is_scalar_global(koopa_raw_value_t ptr){
+    return ptr->kind.tag == KOOPA_RVT_GLOBAL_ALLOC
+        && ptr->ty->data.pointer.base->tag == KOOPA_RTT_INT32;
+}
+
+/* The globals `loop` accesses directly, and whether it stores to each */
+static std::map<koopa_raw_value_t, bool> find_globals(const loop_t &loop){
+    std::map<koopa_raw_value_t, bool> globals;
+    for(auto bb : loop.blocks){
+        for(auto inst : ir_values(bb->insts)){
+            if(inst->kind.tag == KOOPA_RVT_LOAD && is_scalar_global(inst->kind.data.load.src)){
+                globals[inst->kind.data.load.src] |= false;
+            }
+            else if(inst->kind.tag == KOOPA_RVT_STORE && is_scalar_global(inst->kind.data.store.dest)){
+                globals[inst->kind.data.store.dest] = true;
+            }
+        }
+    }
+    return globals;
+}
+
+static bool can_promote(const promote_t &p, const loop_t &loop, koopa_raw_value_t global){
+    for(auto bb : loop.blocks){
+        for(auto inst : ir_values(bb->insts)){
+            koopa_raw_value_t ptr = nullptr;
+            if(inst->kind.tag == KOOPA_RVT_LOAD){
+                ptr = inst->kind.data.load.src;
+            }
+            else if(inst->kind.tag == KOOPA_RVT_STORE){
+                ptr = inst->kind.data.store.dest;
+            }
+            else if(inst->kind.tag == KOOPA_RVT_CALL){
+                if(alias_call_may_read(p.alias, *p.summaries, inst, global)
+                    || alias_call_may_modify(p.alias, *p.summaries, inst, global)){
+                    return false;
+                }
+                continue;
+            }
+            if(ptr != nullptr && ptr != global && alias_may_alias(p.alias, ptr, global)){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* The copy back into `global`, ending with `last` */
+static std::vector<koopa_raw_value_t> write_back(koopa_raw_value_t copy, koopa_raw_value_t global,
+        koopa_raw_value_t last){
+    auto value = ir_new_load(copy);
+    return {value, ir_new_store(value, global), last};
+}
+
+/* Block on the edge to `target`, copying back first; the edge now ends there */
+static koopa_raw_basic_block_t split_exit(koopa_raw_value_t copy, koopa_raw_value_t global,
+        koopa_raw_basic_block_t &target, koopa_raw_slice_t &args){
+    auto exit = ir_new_basic_block("promote_exit");
+    ir_set_params(exit, {});
+    ir_set_insts(exit, write_back(copy, global, ir_new_jump(target, ir_values(args))));
+    target = exit;
+    args = ir_new_slice(std::vector<koopa_raw_value_t>());
+    return exit;
+}
+
+static void promote(const koopa_raw_function_t &func, const loop_t &loop, koopa_raw_value_t global,
+        bool is_stored, koopa_raw_basic_block_t entry){
+    auto copy = ir_new_alloc(ir_type_int32());
+    auto entry_insts = ir_values(entry->insts);
+    entry_insts.insert(entry_insts.begin(), copy);
+    ir_set_insts(entry, entry_insts);
+
+    auto pre_insts = ir_values(loop.preheader->insts);
+    auto value = ir_new_load(global);
+    pre_insts.insert(pre_insts.end() - 1, {value, ir_new_store(value, copy)});
+    ir_set_insts(loop.preheader, pre_insts);
+
+    for(auto bb : loop.blocks){
+        for(auto inst : ir_values(bb->insts)){
+            auto &kind = ir_mut(inst)->kind;
+            if(kind.tag == KOOPA_RVT_LOAD && kind.data.load.src == global){
+                kind.data.load.src = copy;
+            }
+            else if(kind.tag == KOOPA_RVT_STORE && kind.data.store.dest == global){
+                kind.data.store.dest = copy;
+            }
+        }
+    }
+    if(!is_stored){
+        return;
+    }
+
+    auto bbs = ir_basic_blocks(func);
+    for(auto bb : loop.blocks){
+        auto insts = ir_values(bb->insts);
+        auto &kind = ir_mut(insts.back())->kind;
+        std::vector<koopa_raw_basic_block_t> exits;
+        if(kind.tag == KOOPA_RVT_RETURN){
+            auto ret = insts.back();
+            insts.pop_back();
+            auto tail = write_back(copy, global, ret);
+            insts.insert(insts.end(), tail.begin(), tail.end());
+            ir_set_insts(bb, insts);
+        }
+        else if(kind.tag == KOOPA_RVT_JUMP){
+            if(loop.blocks.count(kind.data.jump.target) == 0){
+                exits.push_back(split_exit(copy, global, kind.data.jump.target, kind.data.jump.args));
+            }
+        }
+        else if(kind.tag == KOOPA_RVT_BRANCH){
+            if(loop.blocks.count(kind.data.branch.true_bb) == 0){
+                exits.push_back(split_exit(copy, global, kind.data.branch.true_bb, kind.data.branch.true_args));
+            }
+            if(loop.blocks.count(kind.data.branch.false_bb) == 0){
+                exits.push_back(split_exit(copy, global, kind.data.branch.false_bb, kind.data.branch.false_args));
+            }
+        }
+        if(!exits.empty()){
+            auto pos = std::find(bbs.begin(), bbs.end(), bb) + 1;
+            bbs.insert(pos, exits.begin(), exits.end());
+        }
+    }
+    ir_set_basic_blocks(func, bbs);
+}
+
+static void promote_in_function(const koopa_raw_function_t &func, const call_summaries_t &summaries){
+    ir_remove_unreachable_blocks(func);
+    loops_insert_preheaders(func);
+
+    cfg_t cfg;
+    dom_tree_t dom;
+    std::vector<loop_t> loops;
+    cfg_build(func, cfg);
+    dom_tree_build(cfg, dom);
+    loops_build(cfg, dom, loops);
+
+    promote_t p;
+    p.summaries = &summaries;
+    alias_analyze(func, p.alias);
+
+    std::vector<const loop_t *> order;
+    for(auto &loop : loops){
+        order.push_back(&loop);
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [](const loop_t *a, const loop_t *b){ return a->depth < b->depth; });
+
+    bool promoted = false;
+    for(auto loop : order){
+        for(auto &global : find_globals(*loop)){
+            if(can_promote(p, *loop, global.first)){
+                promote(func, *loop, global.first, global.second, cfg.rpo[0]);
+                promoted = true;
+            }
+        }
+    }
+    if(promoted){
+        opt_mem2reg(func);
+    }
+}
+
+void opt_promote_globals(const koopa_raw_program_t &program){
+    call_summaries_t summaries;
+    alias_call_summaries(program, summaries);
+    for(size_t i = 0; i < program.funcs.len; ++i){
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if(func->bbs.len > 0){
+            promote_in_function(func, summaries);
+        }
+    }
+}
@@ -0,0 +1,330 @@
+#include "opt.h"
+#include "ir.h"
+
+#include <cassert>
+#include <set>
+
+/*
+    Sparse conditional constant propagation (Wegman & Zadeck).
+
+    Values start at TOP and only move down to a constant and then to
+    BOTTOM. Blocks and edges are executable only once reached from the
+    entry through an edge whose branch condition allows it, so a constant
+    condition keeps the other arm (and what it feeds into the block
+    params) out of the solution.
+
+    After mem2reg, locals are SSA values already; what is left in memory
+    that can still be known is a global scalar that is never written.
+*/
+
+typedef enum{
+    LATTICE_TOP,
+    LATTICE_CONST,
+    LATTICE_BOTTOM,
+} lattice_state_t;
+
+typedef struct{
+    lattice_state_t state;
+    int32_t value;
+} lattice_t;
+
+/* Edge into a block: `which` is 0 for a jump / true edge, 1 for a false edge */
+typedef struct{
+    koopa_raw_basic_block_t pred;
+    int which;
+    std::vector<koopa_raw_value_t> args;
+} incoming_t;
+
+typedef struct{
+    const std::map<koopa_raw_value_t, int32_t> *const_globals;
+    std::map<koopa_raw_value_t, lattice_t> lattice;
+    std::map<koopa_raw_value_t, std::vector<koopa_raw_value_t> > users;
+    std::map<koopa_raw_value_t, koopa_raw_basic_block_t> block_of;
+    std::map<koopa_raw_basic_block_t, std::vector<incoming_t> > incoming;
+    std::set<std::pair<koopa_raw_basic_block_t, int> > executable_edges;
+    std::set<koopa_raw_basic_block_t> executable;
+    std::vector<koopa_raw_basic_block_t> flow_worklist;
+    std::vector<koopa_raw_value_t> ssa_worklist;
+} sccp_t;
+
+static const lattice_t lattice_top = {LATTICE_TOP, 0};
+static const lattice_t lattice_bottom = {LATTICE_BOTTOM, 0};
+
+static lattice_t lattice_const(int32_t value){
+    return {LATTICE_CONST, value};
+}
+
+static lattice_t meet(const lattice_t &a, const lattice_t &b){
+    if(a.state == LATTICE_TOP){
+        return b;
+    }
+    if(b.state == LATTICE_TOP){
+        return a;
+    }
+    if(a.state == LATTICE_CONST && b.state == LATTICE_CONST && a.value == b.value){
+        return a;
+    }
+    return lattice_bottom;
+}
+
+static lattice_t lattice_of(const sccp_t &s, koopa_raw_value_t value){
+    if(value->kind.tag == KOOPA_RVT_INTEGER){
+        return lattice_const(value->kind.data.integer.value);
+    }
+    auto it = s.lattice.find(value);
+    if(it != s.lattice.end()){
+        return it->second;
+    }
+    /* Insts and block params not evaluated yet; anything else is unknown */
+    if(s.block_of.count(value)){
+        return lattice_top;
+    }
+    return lattice_bottom;
+}
+
+static void set_lattice(sccp_t &s, koopa_raw_value_t value, const lattice_t &l){
+    auto old = lattice_of(s, value);
+    if(old.state == l.state && (l.state != LATTICE_CONST || old.value == l.value)){
+        return;
+    }
+    s.lattice[value] = l;
+    s.ssa_worklist.push_back(value);
+}
+
+static lattice_t eval_binary(const sccp_t &s, const koopa_raw_binary_t &binary){
+    auto lhs = lattice_of(s, binary.lhs);
+    auto rhs = lattice_of(s, binary.rhs);
+
+    /* x * 0 and x & 0 are 0 whatever x is */
+    if((binary.op == KOOPA_RBO_MUL || binary.op == KOOPA_RBO_AND)
+        && ((lhs.state == LATTICE_CONST && lhs.value == 0)
+            || (rhs.state == LATTICE_CONST && rhs.value == 0))){
+        return lattice_const(0);
+    }
+
+    if(lhs.state == LATTICE_BOTTOM || rhs.state == LATTICE_BOTTOM){
+        return lattice_bottom;
+    }
+    if(lhs.state == LATTICE_TOP || rhs.state == LATTICE_TOP){
+        return lattice_top;
+    }
+    int32_t result;
+    if(!ir_eval_binary(binary.op, lhs.value, rhs.value, result)){
+        return lattice_bottom;
+    }
+    return lattice_const(result);
+}
+
+static void eval_params(sccp_t &s, koopa_raw_basic_block_t bb){
+    auto params = ir_values(bb->params);
+    for(size_t i = 0; i < params.size(); ++i){
+        lattice_t l = lattice_top;
+        for(auto &in : s.incoming[bb]){
+            if(s.executable_edges.count({in.pred, in.which})){
+                l = meet(l, lattice_of(s, in.args[i]));
+            }
+        }
+        set_lattice(s, params[i], l);
+    }
+}
+
+static void mark_edge(sccp_t &s, koopa_raw_basic_block_t bb, int which,
+        koopa_raw_basic_block_t target){
+    s.executable_edges.insert({bb, which});
+    if(s.executable.insert(target).second){
+        s.flow_worklist.push_back(target);
+    }
+    else{
+        /* the arguments may have changed */
+        eval_params(s, target);
+    }
+}
+
+static void eval_inst(sccp_t &s, koopa_raw_value_t inst){
+    auto bb = s.block_of.at(inst);
+    const auto &kind = inst->kind;
+    switch (kind.tag)
+    {
+    case KOOPA_RVT_BINARY:
+        set_lattice(s, inst, eval_binary(s, kind.data.binary));
+        break;
+    case KOOPA_RVT_LOAD:{
+        auto it = s.const_globals->find(kind.data.load.src);
+        set_lattice(s, inst, (it != s.const_globals->end())
+                                ? lattice_const(it->second) : lattice_bottom);
+        break;
+    }
+    case KOOPA_RVT_JUMP:
+        mark_edge(s, bb, 0, kind.data.jump.target);
+        break;
+    case KOOPA_RVT_BRANCH:{
+        auto cond = lattice_of(s, kind.data.branch.cond);
+        if(cond.state == LATTICE_TOP){
+            break;
+        }
+        if(cond.state == LATTICE_BOTTOM || cond.value != 0){
+            mark_edge(s, bb, 0, kind.data.branch.true_bb);
+        }
+        if(cond.state == LATTICE_BOTTOM || cond.value == 0){
+            mark_edge(s, bb, 1, kind.data.branch.false_bb);
+        }
+        break;
+    }
+    default:
+        if(inst->ty->tag != KOOPA_RTT_UNIT){
+            set_lattice(s, inst, lattice_bottom);
+        }
+        break;
+    }
+}
+
+static void solve(const koopa_raw_function_t &func, sccp_t &s){
+    auto bbs = ir_basic_blocks(func);
+    for(auto bb : bbs){
+        for(auto param : ir_values(bb->params)){
+            s.block_of[param] = bb;
+        }
+        for(auto inst : ir_values(bb->insts)){
+            s.block_of[inst] = bb;
+            for(auto operand : ir_operands(inst)){
+                s.users[operand].push_back(inst);
+            }
+        }
+        auto &kind = ir_terminator(bb)->kind;
+        if(kind.tag == KOOPA_RVT_JUMP){
+            s.incoming[kind.data.jump.target].push_back(
+                {bb, 0, ir_values(kind.data.jump.args)});
+        }
+        else if(kind.tag == KOOPA_RVT_BRANCH){
+            s.incoming[kind.data.branch.true_bb].push_back(
+                {bb, 0, ir_values(kind.data.branch.true_args)});
+            s.incoming[kind.data.branch.false_bb].push_back(
+                {bb, 1, ir_values(kind.data.branch.false_args)});
+        }
+    }
+
+    s.executable.insert(bbs[0]);
+    s.flow_worklist.push_back(bbs[0]);
+    while(!s.flow_worklist.empty() || !s.ssa_worklist.empty()){
+        if(!s.flow_worklist.empty()){
+            auto bb = s.flow_worklist.back();
+            s.flow_worklist.pop_back();
+            eval_params(s, bb);
+            for(auto inst : ir_values(bb->insts)){
+                eval_inst(s, inst);
+            }
+            continue;
+        }
+        auto value = s.ssa_worklist.back();
+        s.ssa_worklist.pop_back();
+        for(auto user : s.users[value]){
+            if(s.executable.count(s.block_of.at(user))){
+                eval_inst(s, user);
+            }
+        }
+    }
+}
+
+static void rewrite(const koopa_raw_function_t &func, sccp_t &s){
+    /* Branches with one executable edge become jumps */
+    for(auto bb : ir_basic_blocks(func)){
+        if(s.executable.count(bb) == 0){
+            continue;
+        }
+        auto term = ir_terminator(bb);
+        if(term->kind.tag != KOOPA_RVT_BRANCH){
+            continue;
+        }
+        const auto &branch = term->kind.data.branch;
+        bool is_true = s.executable_edges.count({bb, 0}) > 0;
+        bool is_false = s.executable_edges.count({bb, 1}) > 0;
+        if(is_true == is_false){
+            continue;
+        }
+        auto jump = is_true
+                    ? ir_new_jump(branch.true_bb, ir_values(branch.true_args))
+                    : ir_new_jump(branch.false_bb, ir_values(branch.false_args));
+        auto insts = ir_values(bb->insts);
+        insts.back() = jump;
+        ir_set_insts(bb, insts);
+    }
+    ir_remove_unreachable_blocks(func);
+
+    /* Constants replace their values; the pure insts computing them go away */
+    value_map_t repl;
+    for(auto bb : ir_basic_blocks(func)){
+        std::vector<koopa_raw_value_t> insts;
+        for(auto inst : ir_values(bb->insts)){
+            auto l = lattice_of(s, inst);
+            if(l.state == LATTICE_CONST && !ir_has_side_effect(inst)){
+                repl[inst] = ir_new_integer(l.value, inst->ty);
+                continue;
+            }
+            insts.push_back(inst);
+        }
+        ir_set_insts(bb, insts);
+        for(auto param : ir_values(bb->params)){
+            auto l = lattice_of(s, param);
+            if(l.state == LATTICE_CONST){
+                repl[param] = ir_new_integer(l.value, param->ty);
+            }
+        }
+    }
+    ir_replace_uses(func, repl);
+
+    for(auto bb : ir_basic_blocks(func)){
+        auto params = ir_values(bb->params);
+        for(size_t i = params.size(); i-- > 0;){
+            if(repl.count(params[i])){
+                ir_remove_block_param(func, bb, i);
+            }
+        }
+    }
+}
+
+/* Global scalars that are only ever loaded keep their initial value */
+static std::map<koopa_raw_value_t, int32_t> find_const_globals(const koopa_raw_program_t &program){
+    std::map<koopa_raw_value_t, int32_t> globals;
+    for(auto value : ir_values(program.values)){
+        if(value->kind.tag != KOOPA_RVT_GLOBAL_ALLOC
+            || value->ty->data.pointer.base->tag != KOOPA_RTT_INT32){
+            continue;
+        }
+        auto init = value->kind.data.global_alloc.init;
+        if(init->kind.tag == KOOPA_RVT_INTEGER){
+            globals[value] = init->kind.data.integer.value;
+        }
+        else if(init->kind.tag == KOOPA_RVT_ZERO_INIT){
+            globals[value] = 0;
+        }
+    }
+
+    for(size_t i = 0; i < program.funcs.len; ++i){
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        for(auto bb : ir_basic_blocks(func)){
+            for(auto inst : ir_values(bb->insts)){
+                if(inst->kind.tag == KOOPA_RVT_LOAD){
+                    continue;
+                }
+                for(auto operand : ir_operands(inst)){
+                    globals.erase(operand);
+                }
+            }
+        }
+    }
+    return globals;
+}
+
+void opt_sccp(const koopa_raw_program_t &program){
+    auto const_globals = find_const_globals(program);
+    for(size_t i = 0; i < program.funcs.len; ++i){
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if(func->bbs.len == 0){
+            continue;
+        }
+        sccp_t s;
+        s.const_globals = &const_globals;
+        solve(func, s);
+        rewrite(func, s);
+    }
+}
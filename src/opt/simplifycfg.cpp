@@ -0,0 +1,209 @@
+#include "opt.h"
+#include "ir.h"
+
+#include <set>
+
+/*
+    CFG simplification, repeated until nothing changes:
+    - `br` on a constant, or to the same block with the same args, becomes
+      a `jump`;
+    - edges into a block that holds nothing but a `jump` go straight to
+      where that jump goes;
+    - a block entered only by a `jump` from its single predecessor is
+      merged into it.
+*/
+
+static bool same_args(const koopa_raw_slice_t &a, const koopa_raw_slice_t &b){
+    if(a.len != b.len){
+        return false;
+    }
+    for(size_t i = 0; i < a.len; ++i){
+        if(!ir_same_value(reinterpret_cast<koopa_raw_value_t>(a.buffer[i]),
+                          reinterpret_cast<koopa_raw_value_t>(b.buffer[i]))){
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool fold_branches(const koopa_raw_function_t &func){
+    bool changed = false;
+    for(auto bb : ir_basic_blocks(func)){
+        auto term = ir_terminator(bb);
+        if(term->kind.tag != KOOPA_RVT_BRANCH){
+            continue;
+        }
+        const auto &branch = term->kind.data.branch;
+        koopa_raw_value_t jump = nullptr;
+        if(ir_is_integer(branch.cond)){
+            jump = (branch.cond->kind.data.integer.value != 0)
+                    ? ir_new_jump(branch.true_bb, ir_values(branch.true_args))
+                    : ir_new_jump(branch.false_bb, ir_values(branch.false_args));
+        }
+        else if(branch.true_bb == branch.false_bb
+            && same_args(branch.true_args, branch.false_args)){
+            jump = ir_new_jump(branch.true_bb, ir_values(branch.true_args));
+        }
+        if(jump != nullptr){
+            auto insts = ir_values(bb->insts);
+            insts.back() = jump;
+            ir_set_insts(bb, insts);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/* Blocks made of a single `jump`, whose params are not used by other blocks */
+static std::set<koopa_raw_basic_block_t> find_forwarders(const koopa_raw_function_t &func){
+    auto bbs = ir_basic_blocks(func);
+    std::map<koopa_raw_value_t, koopa_raw_basic_block_t> owner;
+    for(auto bb : bbs){
+        for(auto param : ir_values(bb->params)){
+            owner[param] = bb;
+        }
+    }
+
+    std::set<koopa_raw_basic_block_t> escaping;
+    for(auto bb : bbs){
+        for(auto inst : ir_values(bb->insts)){
+            for(auto operand : ir_operands(inst)){
+                auto it = owner.find(operand);
+                if(it != owner.end() && it->second != bb){
+                    escaping.insert(it->second);
+                }
+            }
+        }
+    }
+
+    std::set<koopa_raw_basic_block_t> forwarders;
+    for(size_t i = 1; i < bbs.size(); ++i){
+        auto bb = bbs[i];
+        if(bb->insts.len == 1 && ir_terminator(bb)->kind.tag == KOOPA_RVT_JUMP
+            && ir_terminator(bb)->kind.data.jump.target != bb
+            && escaping.count(bb) == 0){
+            forwarders.insert(bb);
+        }
+    }
+    return forwarders;
+}
+
+/* Follow `target` through forwarders, translating the args on the way */
+static bool forward_edge(const std::set<koopa_raw_basic_block_t> &forwarders,
+        koopa_raw_basic_block_t &target, koopa_raw_slice_t &args){
+    std::set<koopa_raw_basic_block_t> visited;
+    auto new_target = target;
+    auto new_args = ir_values(args);
+    while(forwarders.count(new_target)){
+        if(!visited.insert(new_target).second){
+            /* a loop of empty blocks; leave it alone */
+            return false;
+        }
+        const auto &jump = ir_terminator(new_target)->kind.data.jump;
+        value_map_t repl;
+        auto params = ir_values(new_target->params);
+        for(size_t i = 0; i < params.size(); ++i){
+            repl[params[i]] = new_args[i];
+        }
+        new_args.clear();
+        for(auto arg : ir_values(jump.args)){
+            auto it = repl.find(arg);
+            new_args.push_back(it == repl.end() ? arg : it->second);
+        }
+        new_target = jump.target;
+    }
+    if(new_target == target){
+        return false;
+    }
+    target = new_target;
+    args = ir_new_slice(new_args);
+    return true;
+}
+
+static bool forward_jumps(const koopa_raw_function_t &func){
+    auto forwarders = find_forwarders(func);
+    if(forwarders.empty()){
+        return false;
+    }
+    bool changed = false;
+    for(auto bb : ir_basic_blocks(func)){
+        auto &kind = ir_mut(ir_terminator(bb))->kind;
+        if(kind.tag == KOOPA_RVT_JUMP){
+            changed |= forward_edge(forwarders, kind.data.jump.target, kind.data.jump.args);
+        }
+        else if(kind.tag == KOOPA_RVT_BRANCH){
+            changed |= forward_edge(forwarders, kind.data.branch.true_bb, kind.data.branch.true_args);
+            changed |= forward_edge(forwarders, kind.data.branch.false_bb, kind.data.branch.false_args);
+        }
+    }
+    return changed;
+}
+
+static bool merge_blocks(const koopa_raw_function_t &func){
+    auto bbs = ir_basic_blocks(func);
+    std::map<koopa_raw_basic_block_t, int> num_preds;
+    for(auto bb : bbs){
+        auto &kind = ir_terminator(bb)->kind;
+        if(kind.tag == KOOPA_RVT_JUMP){
+            num_preds[kind.data.jump.target]++;
+        }
+        else if(kind.tag == KOOPA_RVT_BRANCH){
+            num_preds[kind.data.branch.true_bb]++;
+            num_preds[kind.data.branch.false_bb]++;
+        }
+    }
+
+    value_map_t repl;
+    std::set<koopa_raw_basic_block_t> merged;
+    for(auto bb : bbs){
+        if(merged.count(bb)){
+            continue;
+        }
+        while(true){
+            auto term = ir_terminator(bb);
+            if(term->kind.tag != KOOPA_RVT_JUMP){
+                break;
+            }
+            auto succ = term->kind.data.jump.target;
+            if(succ == bb || succ == bbs[0] || num_preds[succ] != 1){
+                break;
+            }
+
+            auto params = ir_values(succ->params);
+            auto args = ir_values(term->kind.data.jump.args);
+            for(size_t i = 0; i < params.size(); ++i){
+                repl[params[i]] = args[i];
+            }
+            auto insts = ir_values(bb->insts);
+            insts.pop_back();
+            for(auto inst : ir_values(succ->insts)){
+                insts.push_back(inst);
+            }
+            ir_set_insts(bb, insts);
+            merged.insert(succ);
+        }
+    }
+    if(merged.empty()){
+        return false;
+    }
+
+    std::vector<koopa_raw_basic_block_t> kept;
+    for(auto bb : bbs){
+        if(merged.count(bb) == 0){
+            kept.push_back(bb);
+        }
+    }
+    ir_set_basic_blocks(func, kept);
+    ir_replace_uses(func, repl);
+    return true;
+}
+
+void opt_simplify_cfg(const koopa_raw_function_t &func){
+    bool changed = true;
+    while(changed){
+        changed = fold_branches(func);
+        changed |= forward_jumps(func);
+        ir_remove_unreachable_blocks(func);
+        changed |= merge_blocks(func);
+    }
+}
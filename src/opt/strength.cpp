@@ -0,0 +1,201 @@
+#include "opt.h"
+#include "ir.h"
+#include "cfg.h"
+
+#include <tuple>
+
+/*
+    Induction variable strength reduction for array indexing.
+
+    A basic induction variable is a header param `i` that every latch
+    passes on as `i + c` (or `i - c`) with a constant `c`. An address
+    `getelemptr src, i` / `getptr src, i` (or with index `i + d`) taken in
+    the loop, with `src` invariant, becomes a pointer carried along with
+    `i`: it starts as the address of the initial value in the preheader
+    and moves by `getptr p, c` on every latch, a single `addi`. An index
+    `i + d` is then `getptr p, d`.
+
+    `i` goes away when nothing else uses it, which ADCE takes care of.
+*/
+
+typedef std::map<koopa_raw_value_t, koopa_raw_basic_block_t> block_map_t;
+
+/* Header param -> step on each latch */
+typedef std::map<koopa_raw_value_t, std::map<koopa_raw_basic_block_t, int32_t> > iv_map_t;
+
+/* An address in the loop, as (src, induction variable, constant offset) */
+typedef struct{
+    koopa_raw_value_t inst;
+    koopa_raw_value_t iv;
+    int32_t offset;
+} iv_use_t;
+
+/* Args passed by `bb` along its edges to `target`; empty if they differ */
+static std::vector<koopa_raw_value_t> edge_args(koopa_raw_basic_block_t bb,
+        koopa_raw_basic_block_t target){
+    const auto &kind = ir_terminator(bb)->kind;
+    if(kind.tag == KOOPA_RVT_JUMP){
+        return ir_values(kind.data.jump.args);
+    }
+    const auto &branch = kind.data.branch;
+    if(branch.true_bb == target && branch.false_bb == target){
+        auto true_args = ir_values(branch.true_args);
+        auto false_args = ir_values(branch.false_args);
+        return (true_args == false_args) ? true_args : std::vector<koopa_raw_value_t>();
+    }
+    return ir_values(branch.true_bb == target ? branch.true_args : branch.false_args);
+}
+
+static iv_map_t find_induction_vars(const loop_t &loop){
+    iv_map_t ivs;
+    auto params = ir_values(loop.header->params);
+    for(size_t k = 0; k < params.size(); ++k){
+        std::map<koopa_raw_basic_block_t, int32_t> steps;
+        for(auto latch : loop.latches){
+            auto args = edge_args(latch, loop.header);
+            if(args.size() != params.size()){
+                break;
+            }
+            int32_t step;
+            if(ir_split_offset(args[k], step) != params[k] || step == 0){
+                break;
+            }
+            steps[latch] = step;
+        }
+        if(steps.size() == loop.latches.size()){
+            ivs[params[k]] = steps;
+        }
+    }
+    return ivs;
+}
+
+static void insert_before_terminator(koopa_raw_basic_block_t bb, koopa_raw_value_t inst){
+    auto insts = ir_values(bb->insts);
+    insts.insert(insts.end() - 1, inst);
+    ir_set_insts(bb, insts);
+}
+
+static koopa_raw_value_t new_address(koopa_raw_value_tag_t tag, koopa_raw_type_t ty,
+        koopa_raw_value_t src, koopa_raw_value_t index){
+    auto inst = ir_new_value(ty, tag);
+    if(tag == KOOPA_RVT_GET_ELEM_PTR){
+        inst->kind.data.get_elem_ptr.src = src;
+        inst->kind.data.get_elem_ptr.index = index;
+    }
+    else{
+        inst->kind.data.get_ptr.src = src;
+        inst->kind.data.get_ptr.index = index;
+    }
+    return inst;
+}
+
+static void reduce_loop(const loop_t &loop, block_map_t &block_of, value_map_t &repl){
+    auto ivs = find_induction_vars(loop);
+    if(ivs.empty()){
+        return;
+    }
+
+    /* (kind, src, iv) -> the addresses computed from it */
+    std::map<std::tuple<int, koopa_raw_value_t, koopa_raw_value_t>, std::vector<iv_use_t> > groups;
+    for(auto bb : loop.blocks){
+        for(auto inst : ir_values(bb->insts)){
+            koopa_raw_value_t src, index;
+            if(inst->kind.tag == KOOPA_RVT_GET_ELEM_PTR){
+                src = inst->kind.data.get_elem_ptr.src;
+                index = inst->kind.data.get_elem_ptr.index;
+            }
+            else if(inst->kind.tag == KOOPA_RVT_GET_PTR){
+                src = inst->kind.data.get_ptr.src;
+                index = inst->kind.data.get_ptr.index;
+            }
+            else{
+                continue;
+            }
+            auto it = block_of.find(src);
+            if(it != block_of.end() && loop.blocks.count(it->second)){
+                continue;
+            }
+            int32_t offset;
+            auto iv = ir_split_offset(index, offset);
+            if(ivs.count(iv)){
+                groups[{inst->kind.tag, src, iv}].push_back({inst, iv, offset});
+            }
+        }
+    }
+
+    auto params = ir_values(loop.header->params);
+    for(auto &group : groups){
+        auto tag = (koopa_raw_value_tag_t)std::get<0>(group.first);
+        auto src = std::get<1>(group.first);
+        auto iv = std::get<2>(group.first);
+        auto ty = group.second[0].inst->ty;
+
+        /* the address for the initial value, moving with `iv` */
+        auto init = edge_args(loop.preheader, loop.header)[iv->kind.data.block_arg_ref.index];
+        auto start = new_address(tag, ty, src, init);
+        insert_before_terminator(loop.preheader, start);
+        block_of[start] = loop.preheader;
+        ir_append_edge_args(loop.preheader, loop.header, {start});
+
+        auto ptr = ir_new_value(ty, KOOPA_RVT_BLOCK_ARG_REF);
+        params.push_back(ptr);
+        block_of[ptr] = loop.header;
+        for(auto &step : ivs[iv]){
+            auto next = new_address(KOOPA_RVT_GET_PTR, ty, ptr, ir_new_integer(step.second));
+            insert_before_terminator(step.first, next);
+            block_of[next] = step.first;
+            ir_append_edge_args(step.first, loop.header, {next});
+        }
+
+        for(auto &use : group.second){
+            if(use.offset == 0){
+                repl[use.inst] = ptr;
+                continue;
+            }
+            auto &kind = ir_mut(use.inst)->kind;
+            kind.tag = KOOPA_RVT_GET_PTR;
+            kind.data.get_ptr.src = ptr;
+            kind.data.get_ptr.index = ir_new_integer(use.offset);
+        }
+    }
+    ir_set_params(loop.header, params);
+}
+
+void opt_strength_reduce(const koopa_raw_function_t &func){
+    ir_remove_unreachable_blocks(func);
+    loops_insert_preheaders(func);
+
+    cfg_t cfg;
+    dom_tree_t dom;
+    std::vector<loop_t> loops;
+    cfg_build(func, cfg);
+    dom_tree_build(cfg, dom);
+    loops_build(cfg, dom, loops);
+
+    block_map_t block_of;
+    for(auto bb : cfg.rpo){
+        for(auto param : ir_values(bb->params)){
+            block_of[param] = bb;
+        }
+        for(auto inst : ir_values(bb->insts)){
+            block_of[inst] = bb;
+        }
+    }
+
+    value_map_t repl;
+    for(auto &loop : loops){
+        reduce_loop(loop, block_of, repl);
+    }
+
+    /* drop the addresses replaced by the pointers themselves */
+    for(auto bb : cfg.rpo){
+        std::vector<koopa_raw_value_t> insts;
+        for(auto inst : ir_values(bb->insts)){
+            if(repl.count(inst) == 0){
+                insts.push_back(inst);
+            }
+        }
+        ir_set_insts(bb, insts);
+    }
+    ir_replace_uses(func, repl);
+}
@@ -0,0 +1,202 @@
+#include "opt.h"
+#include "ir.h"
+#include "alias.h"
+
+#include <set>
+
+/*
+    Self tail recursion to a loop.
+
+    The body, apart from the `alloc`s, moves from the entry into a loop
+    block whose params take the place of the function's params. A tail
+    call to the function itself,
+
+        %r = call @f(args)
+        ret %r
+
+    becomes `jump %loop(args)`, the frame of this call being reused.
+
+    Linear recursion (no self call but these) returning `%r op x`, where
+    `op` is `add` or `mul`, gets an accumulator: it starts at 0 or 1, the
+    call site jumps back with `acc op x`, and every other `ret v` returns
+    `acc op v` instead. Both are associative and commutative in wrapping
+    arithmetic, so the result is the same.
+
+    A call passing a pointer into the current frame is kept: the next
+    iteration would reuse that memory.
+*/
+
+typedef struct{
+    koopa_raw_basic_block_t bb;
+    koopa_raw_value_t call;
+    koopa_raw_value_t other;    /* `x` of `%r op x`, nullptr for a plain tail call */
+} tail_site_t;
+
+/* Not a pointer into the locals of the current call */
+static bool is_outside_frame(koopa_raw_value_t value){
+    if(value->ty->tag != KOOPA_RTT_POINTER){
+        return true;
+    }
+    auto base = alias_base_object(value);
+    return base->kind.tag == KOOPA_RVT_GLOBAL_ALLOC || base->kind.tag == KOOPA_RVT_FUNC_ARG_REF;
+}
+
+static bool is_self_call(const koopa_raw_function_t &func, koopa_raw_value_t inst){
+    if(inst->kind.tag != KOOPA_RVT_CALL || inst->kind.data.call.callee != func){
+        return false;
+    }
+    for(auto arg : ir_values(inst->kind.data.call.args)){
+        if(!is_outside_frame(arg)){
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Finds the tail sites of `bb`; `op` is set by the first accumulating one */
+static bool find_site(const koopa_raw_function_t &func, koopa_raw_basic_block_t bb,
+        bool &has_op, koopa_raw_binary_op_t &op, tail_site_t &site){
+    auto insts = ir_values(bb->insts);
+    auto ret = insts.back();
+    if(ret->kind.tag != KOOPA_RVT_RETURN){
+        return false;
+    }
+    auto value = ret->kind.data.ret.value;
+    size_t n = insts.size();
+    if(n >= 2 && is_self_call(func, insts[n - 2])
+        && (value == insts[n - 2] || (value == nullptr && insts[n - 2]->ty->tag == KOOPA_RTT_UNIT))){
+        site = {bb, insts[n - 2], nullptr};
+        return true;
+    }
+    if(n < 3 || value != insts[n - 2] || value->kind.tag != KOOPA_RVT_BINARY
+        || !is_self_call(func, insts[n - 3])){
+        return false;
+    }
+    auto call = insts[n - 3];
+    const auto &binary = value->kind.data.binary;
+    if(binary.op != KOOPA_RBO_ADD && binary.op != KOOPA_RBO_MUL){
+        return false;
+    }
+    if((binary.lhs == call) == (binary.rhs == call)){
+        return false;
+    }
+    if(has_op && op != binary.op){
+        return false;
+    }
+    has_op = true;
+    op = binary.op;
+    site = {bb, call, (binary.lhs == call) ? binary.rhs : binary.lhs};
+    return true;
+}
+
+void opt_tail_recursion(const koopa_raw_function_t &func){
+    ir_remove_unreachable_blocks(func);
+    auto bbs = ir_basic_blocks(func);
+    std::vector<tail_site_t> sites;
+    bool has_op = false;
+    koopa_raw_binary_op_t op = KOOPA_RBO_ADD;
+    for(auto bb : bbs){
+        tail_site_t site;
+        if(find_site(func, bb, has_op, op, site)){
+            sites.push_back(site);
+        }
+    }
+    /* with other recursive calls left, the accumulator only adds work */
+    if(has_op){
+        size_t num_self_calls = 0;
+        for(auto bb : bbs){
+            for(auto inst : ir_values(bb->insts)){
+                num_self_calls += (inst->kind.tag == KOOPA_RVT_CALL && inst->kind.data.call.callee == func);
+            }
+        }
+        if(num_self_calls > sites.size()){
+            has_op = false;
+            std::vector<tail_site_t> plain;
+            for(auto &site : sites){
+                if(site.other == nullptr){
+                    plain.push_back(site);
+                }
+            }
+            sites = plain;
+        }
+    }
+    if(sites.empty()){
+        return;
+    }
+
+    /* the body moves into the loop, its params replacing the function's */
+    auto entry = bbs[0];
+    auto loop = ir_new_basic_block("tailrec");
+    auto func_params = ir_values(func->params);
+    std::vector<koopa_raw_value_t> params;
+    value_map_t repl;
+    for(auto param : func_params){
+        params.push_back(ir_new_value(param->ty, KOOPA_RVT_BLOCK_ARG_REF));
+        repl[param] = params.back();
+    }
+    koopa_raw_value_t acc = nullptr;
+    if(has_op){
+        acc = ir_new_value(ir_type_int32(), KOOPA_RVT_BLOCK_ARG_REF);
+        params.push_back(acc);
+    }
+    ir_set_params(loop, params);
+
+    std::vector<koopa_raw_value_t> allocs, body;
+    for(auto inst : ir_values(entry->insts)){
+        (inst->kind.tag == KOOPA_RVT_ALLOC ? allocs : body).push_back(inst);
+    }
+    ir_set_insts(loop, body);
+    ir_set_insts(entry, allocs);
+    bbs.insert(bbs.begin() + 1, loop);
+    ir_set_basic_blocks(func, bbs);
+    ir_replace_uses(func, repl);
+
+    std::set<koopa_raw_basic_block_t> site_bbs;
+    for(auto &site : sites){
+        /* the entry's instructions are in the loop by now */
+        auto bb = (site.bb == entry) ? loop : site.bb;
+        site_bbs.insert(bb);
+        auto insts = ir_values(bb->insts);
+        insts.resize(insts.size() - (site.other == nullptr ? 2 : 3));
+        auto args = ir_values(site.call->kind.data.call.args);
+        if(has_op){
+            auto next = acc;
+            if(site.other != nullptr){
+                auto other = repl.count(site.other) ? repl[site.other] : site.other;
+                next = ir_new_binary(op, acc, other);
+                insts.push_back(next);
+            }
+            args.push_back(next);
+        }
+        insts.push_back(ir_new_jump(loop, args));
+        ir_set_insts(bb, insts);
+    }
+
+    /* other returns add the accumulated part */
+    if(has_op){
+        for(auto bb : bbs){
+            if(bb == entry || site_bbs.count(bb)){
+                continue;
+            }
+            auto insts = ir_values(bb->insts);
+            auto &ret = insts.back();
+            if(ret->kind.tag != KOOPA_RVT_RETURN){
+                continue;
+            }
+            auto result = ir_new_binary(op, acc, ret->kind.data.ret.value);
+            auto new_ret = ir_new_value(ir_type_unit(), KOOPA_RVT_RETURN);
+            new_ret->kind.data.ret.value = result;
+            ret = new_ret;
+            insts.insert(insts.end() - 1, result);
+            ir_set_insts(bb, insts);
+        }
+    }
+
+    auto entry_insts = allocs;
+    auto init = func_params;
+    if(has_op){
+        init.push_back(ir_new_integer(op == KOOPA_RBO_ADD ? 0 : 1));
+    }
+    entry_insts.push_back(ir_new_jump(loop, init));
+    ir_set_insts(entry, entry_insts);
+}
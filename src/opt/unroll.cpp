@@ -0,0 +1,368 @@
+#include "opt.h"
+#include "ir.h"
+#include "cfg.h"
+
+#include <set>
+
+/*
+    Loop unrolling, for innermost loops with a single latch that only
+    leave from their header.
+
+    The header must branch on a comparison of an induction variable `i`
+    (a header param the latch passes on as `i + c`). When `i` starts at a
+    constant and is compared with a constant, the trip count is found by
+    running through the iterations. A loop with a small known count is
+    fully unrolled: the preheader enters a chain of copies of the loop,
+    one per iteration, the last jumping to the original header, whose
+    test SCCP then folds to false.
+
+    Otherwise a loop running while `i < n`, with `n` invariant and
+    `c > 0`, is unrolled `UNROLL_FACTOR` times. The new main loop runs
+    that many copies per trip while `i < n - (UNROLL_FACTOR - 1) * c`,
+    and the original loop is left to do the remaining iterations. The
+    main loop is skipped when that bound would wrap around.
+
+    In the copies, `i` is `i + k * c` from the main loop's param, so
+    strength reduction still finds a single induction variable.
+*/
+
+static const size_t UNROLL_FULL_MAX_TRIPS = 16;
+static const size_t UNROLL_FULL_BUDGET = 256;       /* instructions once unrolled */
+static const size_t UNROLL_FACTOR = 4;
+static const size_t UNROLL_PARTIAL_MAX_SIZE = 48;   /* instructions in the loop */
+
+typedef std::map<koopa_raw_value_t, koopa_raw_basic_block_t> block_map_t;
+typedef std::map<koopa_raw_basic_block_t, koopa_raw_basic_block_t> bb_map_t;
+
+typedef struct{
+    bb_list_t bbs;              /* in RPO, the header first */
+    koopa_raw_basic_block_t body;   /* successor of the header in the loop */
+    koopa_raw_basic_block_t latch;
+    koopa_raw_value_t cond;
+    size_t iv;                  /* index of `i` in the header params */
+    int32_t step;
+    size_t size;
+} loop_shape_t;
+
+/* One copy of the loop, its header copy first */
+typedef struct{
+    bb_list_t bbs;
+    koopa_raw_basic_block_t latch;
+    koopa_raw_value_t back_jump;    /* still targeting the original header */
+} iteration_t;
+
+static bool is_innermost(const std::vector<loop_t> &loops, size_t index){
+    for(auto &loop : loops){
+        if(loop.parent == (int)index){
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool analyze(const loop_t &loop, const bb_list_t &rpo, loop_shape_t &shape){
+    if(loop.preheader == nullptr || loop.latches.size() != 1
+        || ir_terminator(loop.latches[0])->kind.tag != KOOPA_RVT_JUMP){
+        return false;
+    }
+    shape.latch = loop.latches[0];
+    shape.size = 0;
+    shape.bbs.clear();
+    for(auto bb : rpo){
+        if(loop.blocks.count(bb) == 0){
+            continue;
+        }
+        shape.bbs.push_back(bb);
+        shape.size += bb->insts.len;
+        if(bb == loop.header){
+            continue;
+        }
+        for(auto succ : ir_successors(bb)){
+            if(loop.blocks.count(succ) == 0){
+                return false;
+            }
+        }
+    }
+
+    auto term = ir_terminator(loop.header);
+    if(term->kind.tag != KOOPA_RVT_BRANCH){
+        return false;
+    }
+    const auto &branch = term->kind.data.branch;
+    if(!loop.blocks.count(branch.true_bb) || loop.blocks.count(branch.false_bb)){
+        return false;
+    }
+    shape.body = branch.true_bb;
+    shape.cond = branch.cond;
+    if(shape.cond->kind.tag != KOOPA_RVT_BINARY){
+        return false;
+    }
+
+    auto params = ir_values(loop.header->params);
+    auto latch_args = ir_values(ir_terminator(shape.latch)->kind.data.jump.args);
+    for(size_t k = 0; k < params.size(); ++k){
+        const auto &binary = shape.cond->kind.data.binary;
+        if(binary.lhs != params[k] && binary.rhs != params[k]){
+            continue;
+        }
+        int32_t step;
+        if(ir_split_offset(latch_args[k], step) == params[k] && step != 0){
+            shape.iv = k;
+            shape.step = step;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Iterations of a loop testing `i` against a constant from a constant start; -1 if not known */
+static int trip_count(const loop_t &loop, const loop_shape_t &shape){
+    auto init = ir_values(ir_terminator(loop.preheader)->kind.data.jump.args)[shape.iv];
+    auto iv = ir_values(loop.header->params)[shape.iv];
+    const auto &binary = shape.cond->kind.data.binary;
+    auto other = (binary.lhs == iv) ? binary.rhs : binary.lhs;
+    if(!ir_is_integer(init) || !ir_is_integer(other) || binary.lhs == binary.rhs){
+        return -1;
+    }
+
+    int32_t value = init->kind.data.integer.value;
+    int32_t bound = other->kind.data.integer.value;
+    for(size_t count = 0; count <= UNROLL_FULL_MAX_TRIPS; ++count){
+        int32_t result;
+        bool is_ok = (binary.lhs == iv)
+                    ? ir_eval_binary(binary.op, value, bound, result)
+                    : ir_eval_binary(binary.op, bound, value, result);
+        if(!is_ok){
+            return -1;
+        }
+        if(result == 0){
+            return (int)count;
+        }
+        ir_eval_binary(KOOPA_RBO_ADD, value, shape.step, value);
+    }
+    return -1;
+}
+
+/*
+    Copy the loop for one iteration, entered with `header_args`. With
+    `iv_base` set, `i` is `iv_base + iv_offset` instead.
+*/
+static iteration_t copy_iteration(const loop_t &loop, const loop_shape_t &shape,
+        std::vector<koopa_raw_value_t> header_args, koopa_raw_value_t iv_base, int32_t iv_offset){
+    value_map_t values;
+    bb_map_t bbs;
+    iteration_t it;
+
+    std::vector<koopa_raw_value_t> header_insts;
+    if(iv_base != nullptr){
+        header_args[shape.iv] = iv_base;
+        if(iv_offset != 0){
+            header_args[shape.iv] = ir_new_binary(KOOPA_RBO_ADD, iv_base, ir_new_integer(iv_offset));
+            header_insts.push_back(header_args[shape.iv]);
+        }
+    }
+    auto header_params = ir_values(loop.header->params);
+    for(size_t k = 0; k < header_params.size(); ++k){
+        values[header_params[k]] = header_args[k];
+    }
+
+    for(auto bb : shape.bbs){
+        auto copy = ir_new_basic_block("unroll");
+        bbs[bb] = copy;
+        it.bbs.push_back(copy);
+        std::vector<koopa_raw_value_t> params;
+        if(bb != loop.header){
+            for(auto param : ir_values(bb->params)){
+                params.push_back(ir_new_value(param->ty, KOOPA_RVT_BLOCK_ARG_REF));
+                values[param] = params.back();
+            }
+        }
+        ir_set_params(copy, params);
+        auto insts = (bb == loop.header) ? header_insts : std::vector<koopa_raw_value_t>();
+        for(auto inst : ir_values(bb->insts)){
+            auto copy_value = ir_copy_inst(inst);
+            values[inst] = copy_value;
+            insts.push_back(copy_value);
+        }
+        ir_set_insts(copy, insts);
+    }
+    it.latch = bbs[shape.latch];
+
+    auto lookup = [&](koopa_raw_value_t v){
+        auto found = values.find(v);
+        return (found == values.end()) ? v : found->second;
+    };
+    for(auto copy : it.bbs){
+        auto insts = ir_values(copy->insts);
+        for(auto inst : insts){
+            ir_rewrite_operands(inst, lookup);
+        }
+        auto &kind = ir_mut(insts.back())->kind;
+        if(copy == it.bbs[0]){
+            /* the test is known to pass */
+            insts.back() = ir_new_jump(bbs[shape.body], ir_values(kind.data.branch.true_args));
+            ir_set_insts(copy, insts);
+        }
+        else if(kind.tag == KOOPA_RVT_BRANCH){
+            kind.data.branch.true_bb = bbs[kind.data.branch.true_bb];
+            kind.data.branch.false_bb = bbs[kind.data.branch.false_bb];
+        }
+        else if(kind.tag == KOOPA_RVT_JUMP && kind.data.jump.target != loop.header){
+            kind.data.jump.target = bbs[kind.data.jump.target];
+        }
+        else if(kind.tag == KOOPA_RVT_JUMP){
+            it.back_jump = insts.back();
+        }
+    }
+    return it;
+}
+
+static void set_jump(koopa_raw_value_t jump, koopa_raw_basic_block_t target,
+        const std::vector<koopa_raw_value_t> &args){
+    auto &data = ir_mut(jump)->kind.data.jump;
+    data.target = target;
+    data.args = ir_new_slice(args);
+}
+
+static void insert_before_terminator(koopa_raw_basic_block_t bb,
+        const std::vector<koopa_raw_value_t> &new_insts){
+    auto insts = ir_values(bb->insts);
+    insts.insert(insts.end() - 1, new_insts.begin(), new_insts.end());
+    ir_set_insts(bb, insts);
+}
+
+static bb_list_t unroll_full(const loop_t &loop, const loop_shape_t &shape, int count){
+    bb_list_t added;
+    auto jump = ir_terminator(loop.preheader);
+    auto args = ir_values(jump->kind.data.jump.args);
+    for(int k = 0; k < count; ++k){
+        auto it = copy_iteration(loop, shape, args, nullptr, 0);
+        set_jump(jump, it.bbs[0], {});
+        added.insert(added.end(), it.bbs.begin(), it.bbs.end());
+        jump = it.back_jump;
+        args = ir_values(jump->kind.data.jump.args);
+    }
+    return added;
+}
+
+static bb_list_t unroll_partial(const loop_t &loop, const loop_shape_t &shape){
+    const auto &binary = shape.cond->kind.data.binary;
+    auto n = (binary.op == KOOPA_RBO_LT) ? binary.rhs : binary.lhs;
+    int32_t margin = (int32_t)(UNROLL_FACTOR - 1) * shape.step;
+
+    /* main loop only if n - margin does not wrap */
+    auto bound = ir_new_binary(KOOPA_RBO_SUB, n, ir_new_integer(margin));
+    auto is_ok = ir_new_binary(KOOPA_RBO_LT, bound, n);
+    insert_before_terminator(loop.preheader, {bound, is_ok});
+
+    auto main = ir_new_basic_block("unroll_loop");
+    std::vector<koopa_raw_value_t> params;
+    for(auto param : ir_values(loop.header->params)){
+        params.push_back(ir_new_value(param->ty, KOOPA_RVT_BLOCK_ARG_REF));
+    }
+    ir_set_params(main, params);
+    auto iv = params[shape.iv];
+
+    bb_list_t added = {main};
+    koopa_raw_value_t jump = nullptr;
+    auto args = params;
+    for(size_t k = 0; k < UNROLL_FACTOR; ++k){
+        auto it = copy_iteration(loop, shape, args, iv, (int32_t)k * shape.step);
+        if(jump == nullptr){
+            auto test = ir_new_binary(KOOPA_RBO_LT, iv, bound);
+            ir_set_insts(main, {test, ir_new_branch(test, it.bbs[0], {}, loop.header, params)});
+        }
+        else{
+            set_jump(jump, it.bbs[0], {});
+        }
+        added.insert(added.end(), it.bbs.begin(), it.bbs.end());
+        jump = it.back_jump;
+        args = ir_values(jump->kind.data.jump.args);
+        if(k + 1 == UNROLL_FACTOR){
+            args[shape.iv] = ir_new_binary(KOOPA_RBO_ADD, iv,
+                                ir_new_integer((int32_t)UNROLL_FACTOR * shape.step));
+            insert_before_terminator(it.latch, {args[shape.iv]});
+            set_jump(jump, main, args);
+        }
+    }
+
+    auto init = ir_values(ir_terminator(loop.preheader)->kind.data.jump.args);
+    auto insts = ir_values(loop.preheader->insts);
+    insts.back() = ir_new_branch(is_ok, main, init, loop.header, init);
+    ir_set_insts(loop.preheader, insts);
+    return added;
+}
+
+static bool can_unroll_partial(const loop_t &loop, const block_map_t &block_of,
+        const loop_shape_t &shape){
+    if(shape.size > UNROLL_PARTIAL_MAX_SIZE || shape.step <= 0
+        || shape.step > (1 << 20)){
+        return false;
+    }
+    const auto &binary = shape.cond->kind.data.binary;
+    auto iv = ir_values(loop.header->params)[shape.iv];
+    koopa_raw_value_t n;
+    if(binary.op == KOOPA_RBO_LT && binary.lhs == iv){
+        n = binary.rhs;
+    }
+    else if(binary.op == KOOPA_RBO_GT && binary.rhs == iv){
+        n = binary.lhs;
+    }
+    else{
+        return false;
+    }
+    auto it = block_of.find(n);
+    return n != iv && (it == block_of.end() || loop.blocks.count(it->second) == 0);
+}
+
+void opt_unroll(const koopa_raw_function_t &func){
+    ir_remove_unreachable_blocks(func);
+    loops_insert_preheaders(func);
+
+    cfg_t cfg;
+    dom_tree_t dom;
+    std::vector<loop_t> loops;
+    cfg_build(func, cfg);
+    dom_tree_build(cfg, dom);
+    loops_build(cfg, dom, loops);
+
+    block_map_t block_of;
+    for(auto bb : cfg.rpo){
+        for(auto param : ir_values(bb->params)){
+            block_of[param] = bb;
+        }
+        for(auto inst : ir_values(bb->insts)){
+            block_of[inst] = bb;
+        }
+    }
+
+    for(size_t i = 0; i < loops.size(); ++i){
+        const auto &loop = loops[i];
+        loop_shape_t shape;
+        if(!is_innermost(loops, i) || !analyze(loop, cfg.rpo, shape)){
+            continue;
+        }
+
+        bb_list_t added;
+        int count = trip_count(loop, shape);
+        if(count > 0 && (size_t)count * shape.size <= UNROLL_FULL_BUDGET){
+            added = unroll_full(loop, shape, count);
+        }
+        else if((count < 0 || (size_t)count > 2 * UNROLL_FACTOR)
+            && can_unroll_partial(loop, block_of, shape)){
+            added = unroll_partial(loop, shape);
+        }
+        if(added.empty()){
+            continue;
+        }
+
+        auto bbs = ir_basic_blocks(func);
+        for(size_t k = 0; k < bbs.size(); ++k){
+            if(bbs[k] == loop.header){
+                bbs.insert(bbs.begin() + k, added.begin(), added.end());
+                break;
+            }
+        }
+        ir_set_basic_blocks(func, bbs);
+    }
+}
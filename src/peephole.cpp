@@ -0,0 +1,257 @@
+#include "peephole.h"
+
+#include <iostream>
+#include <map>
+
+bool peephole_enabled = false;
+
+typedef std::vector<std::string> tokens_t;
+typedef std::map<std::string, std::string> bindings_t;
+
+/* Checks what a pattern cannot say; may bind more names for the replacement */
+typedef bool (*peephole_guard_t)(bindings_t &b, const std::vector<tokens_t> &lines, size_t next);
+
+typedef struct{
+    const char *name;
+    std::vector<std::string> pattern;
+    std::vector<std::string> replacement;
+    peephole_guard_t guard;
+} peephole_rule_t;
+
+static const std::map<std::string, std::string> branch_inverse = {
+    {"beqz", "bnez"}, {"bnez", "beqz"},
+    {"beq", "bne"}, {"bne", "beq"},
+    {"blt", "bge"}, {"bge", "blt"},
+    {"bgt", "ble"}, {"ble", "bgt"},
+};
+
+/* "sw t0, 8(sp)" -> sw t0 8 ( sp ); "label:" -> label : */
+static tokens_t tokenize(const std::string &text){
+    tokens_t tokens;
+    std::string token;
+    auto flush = [&](){
+        if(!token.empty()){
+            tokens.push_back(token);
+            token.clear();
+        }
+    };
+    for(char c : text){
+        if(c == ' ' || c == '\t' || c == ','){
+            flush();
+        }
+        else if(c == '(' || c == ')' || c == ':'){
+            flush();
+            tokens.push_back(std::string(1, c));
+        }
+        else{
+            token += c;
+        }
+    }
+    flush();
+    return tokens;
+}
+
+static std::string to_text(const tokens_t &tokens){
+    if(tokens.back() == ":"){
+        return tokens[0] + ":";
+    }
+    std::string text = "\t" + tokens[0];
+    for(size_t i = 1; i < tokens.size(); ++i){
+        if(tokens[i] == "("){
+            text += "(" + tokens[i + 1] + ")";
+            i += 2;
+            continue;
+        }
+        text += (i == 1) ? "\t" : ", ";
+        text += tokens[i];
+    }
+    return text;
+}
+
+static bool is_immediate(const std::string &token, long lo, long hi){
+    size_t end = 0;
+    long value;
+    try{
+        value = std::stol(token, &end);
+    }
+    catch(...){
+        return false;
+    }
+    return end == token.size() && value >= lo && value <= hi;
+}
+
+/*
+    The value of t register `reg` is not read from line `next` on. The
+    backend keeps nothing in t registers across labels, jumps and calls.
+*/
+static bool is_dead_after(const std::string &reg, const std::vector<tokens_t> &lines, size_t next){
+    if(reg[0] != 't'){
+        return false;
+    }
+    for(size_t i = next; i < lines.size(); ++i){
+        const auto &t = lines[i];
+        if(t.empty()){
+            continue;
+        }
+        if(t.back() == ":" || t[0] == "j" || t[0] == "call" || t[0] == "tail" || t[0] == "ret"){
+            return true;
+        }
+        bool is_write = t[0] != "sw" && t[0][0] != 'b';
+        for(size_t k = is_write ? 2 : 1; k < t.size(); ++k){
+            if(t[k] == reg){
+                return false;
+            }
+        }
+        if(is_write && t.size() > 1 && t[1] == reg){
+            return true;
+        }
+    }
+    return true;
+}
+
+static bool guard_base_kept(bindings_t &b, const std::vector<tokens_t> &, size_t){
+    return b["$a"] != b["$b"];
+}
+
+static bool guard_shift_amount(bindings_t &b, const std::vector<tokens_t> &lines, size_t next){
+    return is_immediate(b["$k"], 0, 31) && b["$s"] != b["$t"]
+        && (b["$d"] == b["$t"] || is_dead_after(b["$t"], lines, next));
+}
+
+static bool guard_branch(bindings_t &b, const std::vector<tokens_t> &, size_t){
+    auto it = branch_inverse.find(b["$br"]);
+    if(it == branch_inverse.end()){
+        return false;
+    }
+    b["$inv"] = it->second;
+    return true;
+}
+
+static const std::vector<peephole_rule_t> rules = {
+    /* reloading what was just stored */
+    {"store-load-same", {"sw $a, $o($b)", "lw $a, $o($b)"}, {"sw $a, $o($b)"}, nullptr},
+    {"store-load", {"sw $a, $o($b)", "lw $c, $o($b)"}, {"sw $a, $o($b)", "mv $c, $a"}, nullptr},
+    {"load-load", {"lw $a, $o($b)", "lw $c, $o($b)"}, {"lw $a, $o($b)", "mv $c, $a"}, guard_base_kept},
+    {"store-store", {"sw $a, $o($b)", "sw $c, $o($b)"}, {"sw $c, $o($b)"}, nullptr},
+    /* shift amounts put in a register first */
+    {"li-sll", {"li $t, $k", "sll $d, $s, $t"}, {"slli $d, $s, $k"}, guard_shift_amount},
+    {"li-srl", {"li $t, $k", "srl $d, $s, $t"}, {"srli $d, $s, $k"}, guard_shift_amount},
+    {"li-sra", {"li $t, $k", "sra $d, $s, $t"}, {"srai $d, $s, $k"}, guard_shift_amount},
+    /* moves that do nothing, e.g. `addi sp, sp, 0` of an empty frame */
+    {"addi-zero-self", {"addi $a, $a, 0"}, {}, nullptr},
+    {"addi-zero", {"addi $d, $s, 0"}, {"mv $d, $s"}, nullptr},
+    {"mv-self", {"mv $a, $a"}, {}, nullptr},
+    /* control flow */
+    {"jump-next", {"j $L", "$L:"}, {"$L:"}, nullptr},
+    {"branch-over-jump", {"$br $x, $y, $L1", "j $L2", "$L1:"},
+        {"$inv $x, $y, $L2", "$L1:"}, guard_branch},
+    {"branchz-over-jump", {"$br $x, $L1", "j $L2", "$L1:"},
+        {"$inv $x, $L2", "$L1:"}, guard_branch},
+};
+
+static std::map<std::string, int> stats;
+
+static bool match(const tokens_t &pattern, const tokens_t &tokens, bindings_t &b){
+    if(pattern.size() != tokens.size()){
+        return false;
+    }
+    for(size_t i = 0; i < pattern.size(); ++i){
+        const auto &p = pattern[i];
+        if(p.size() > 1 && p[0] == '$'){
+            auto it = b.find(p);
+            if(it == b.end()){
+                b[p] = tokens[i];
+            }
+            else if(it->second != tokens[i]){
+                return false;
+            }
+        }
+        else if(p != tokens[i]){
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Apply `rule` (its pattern tokenized) at line `i`; true if it fired */
+static bool apply(const peephole_rule_t &rule, const std::vector<tokens_t> &patterns,
+        std::vector<std::string> &lines, std::vector<tokens_t> &tokens, size_t i){
+    bindings_t b;
+    std::vector<size_t> window;
+    size_t j = i;
+    for(auto &pattern : patterns){
+        while(j < tokens.size() && tokens[j].empty()){
+            ++j;
+        }
+        if(j == tokens.size() || !match(pattern, tokens[j], b)){
+            return false;
+        }
+        window.push_back(j++);
+    }
+    if(rule.guard != nullptr && !rule.guard(b, tokens, j)){
+        return false;
+    }
+
+    std::vector<std::string> new_lines;
+    std::vector<tokens_t> new_tokens;
+    for(auto &replacement : rule.replacement){
+        auto t = tokenize(replacement);
+        for(auto &token : t){
+            if(b.count(token)){
+                token = b[token];
+            }
+        }
+        new_lines.push_back(to_text(t));
+        new_tokens.push_back(t);
+    }
+    for(size_t k = window.size(); k-- > 0;){
+        lines.erase(lines.begin() + window[k]);
+        tokens.erase(tokens.begin() + window[k]);
+    }
+    lines.insert(lines.begin() + i, new_lines.begin(), new_lines.end());
+    tokens.insert(tokens.begin() + i, new_tokens.begin(), new_tokens.end());
+    stats[rule.name]++;
+    return true;
+}
+
+void peephole_run(std::vector<std::string> &lines){
+    if(!peephole_enabled){
+        return;
+    }
+    static std::vector<std::vector<tokens_t> > patterns;
+    if(patterns.empty()){
+        for(auto &rule : rules){
+            patterns.emplace_back();
+            for(auto &pattern : rule.pattern){
+                patterns.back().push_back(tokenize(pattern));
+            }
+        }
+    }
+
+    std::vector<tokens_t> tokens;
+    for(auto &line : lines){
+        tokens.push_back(tokenize(line));
+    }
+
+    bool changed = true;
+    while(changed){
+        changed = false;
+        for(size_t i = 0; i < lines.size(); ++i){
+            if(tokens[i].empty()){
+                continue;
+            }
+            for(size_t r = 0; r < rules.size(); ++r){
+                if(apply(rules[r], patterns[r], lines, tokens, i)){
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void peephole_report(){
+    for(auto &rule : rules){
+        std::cerr << "DEBUG: peephole " << rule.name << ": " << stats[rule.name] << std::endl;
+    }
+}
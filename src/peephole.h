@@ -0,0 +1,21 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <string>
+#include <vector>
+
+/*
+    Peephole optimisation over the assembly text of a function.
+
+    Rules (see `peephole.cpp`) are instruction patterns: `$name` matches
+    any one operand, label or opcode, the same name binding the same text
+    throughout a rule; anything else matches literally. Blank lines are
+    skipped while matching and kept.
+*/
+extern bool peephole_enabled;
+
+void peephole_run(std::vector<std::string> &lines);
+/* How many times each rule fired, to stderr */
+void peephole_report();
+
+#endif /**< src/peephole.h */
@@ -0,0 +1,405 @@
+#include "regalloc.h"
+#include "frame.h"
+#include "ir.h"
+#include "cfg.h"
+
+#include <algorithm>
+
+typedef std::set<koopa_raw_value_t> live_set_t;
+typedef std::map<koopa_raw_value_t, std::set<koopa_raw_value_t> > interference_t;
+typedef std::map<koopa_raw_value_t, double> weights_t;
+
+static const std::vector<std::string> arg_regs = {
+    "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7"
+};
+static const std::vector<std::string> saved_regs = {
+    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11"
+};
+
+/* Blocks coloured together */
+typedef struct{
+    bb_list_t bbs;          /* entry first */
+    std::set<koopa_raw_basic_block_t> in_region;
+    const std::set<koopa_raw_value_t> *candidates;
+    live_set_t exit_live;   /* live into the blocks outside it jumped to */
+    std::map<koopa_raw_basic_block_t, live_set_t> live_in;
+    std::map<koopa_raw_basic_block_t, live_set_t> live_out;
+    interference_t edges;
+    live_set_t across_call;
+} region_t;
+
+/* Not emitted where it stands: done at each use */
+static bool is_inlined(koopa_raw_value_t value){
+    return folded_addrs.count(value) || fused_branch_conds.count(value);
+}
+
+/* Candidates read by `inst`, looking through folded addresses and fused comparisons */
+static void add_uses(const region_t &r, koopa_raw_value_t inst, live_set_t &live){
+    for(auto operand : ir_operands(inst)){
+        if(is_inlined(operand)){
+            add_uses(r, operand, live);
+        }
+        else if(r.candidates->count(operand)){
+            live.insert(operand);
+        }
+    }
+}
+
+static void add_edge(region_t &r, koopa_raw_value_t a, koopa_raw_value_t b){
+    if(a != b){
+        r.edges[a].insert(b);
+        r.edges[b].insert(a);
+    }
+}
+
+/*
+    Walk `bb` backwards from its live-out set; with `is_final`, record
+    interference and the values live across calls. Returns the live-in set.
+*/
+static live_set_t scan_block(region_t &r, koopa_raw_basic_block_t bb, bool is_final){
+    live_set_t live = r.live_out[bb];
+    auto insts = ir_values(bb->insts);
+    for(size_t i = insts.size(); i-- > 0;){
+        auto inst = insts[i];
+        if(is_inlined(inst)){
+            continue;
+        }
+        if(r.candidates->count(inst)){
+            if(is_final){
+                for(auto other : live){
+                    add_edge(r, inst, other);
+                }
+            }
+            live.erase(inst);
+        }
+        if(is_final && inst->kind.tag == KOOPA_RVT_CALL){
+            r.across_call.insert(live.begin(), live.end());
+        }
+        add_uses(r, inst, live);
+    }
+
+    auto params = ir_values(bb->params);
+    for(auto param : params){
+        live.erase(param);
+    }
+    if(is_final){
+        for(auto param : params){
+            if(r.candidates->count(param) == 0){
+                continue;
+            }
+            for(auto other : live){
+                add_edge(r, param, other);
+            }
+            for(auto other : params){
+                if(r.candidates->count(other)){
+                    add_edge(r, param, other);
+                }
+            }
+        }
+    }
+    return live;
+}
+
+static void compute_liveness(region_t &r){
+    bool changed = true;
+    while(changed){
+        changed = false;
+        for(size_t i = r.bbs.size(); i-- > 0;){
+            auto bb = r.bbs[i];
+            live_set_t out;
+            for(auto succ : ir_successors(bb)){
+                const auto &in = r.in_region.count(succ) ? r.live_in[succ] : r.exit_live;
+                out.insert(in.begin(), in.end());
+            }
+            r.live_out[bb] = out;
+            auto in = scan_block(r, bb, false);
+            if(in != r.live_in[bb]){
+                r.live_in[bb] = in;
+                changed = true;
+            }
+        }
+    }
+}
+
+static void analyze_region(region_t &r){
+    compute_liveness(r);
+    for(auto bb : r.bbs){
+        scan_block(r, bb, true);
+    }
+    /* what is live into the entry arrives together */
+    const auto &entry_live = r.live_in[r.bbs[0]];
+    for(auto a : entry_live){
+        for(auto b : entry_live){
+            add_edge(r, a, b);
+        }
+    }
+}
+
+/* Uses and definitions, weighted by 10 per loop level around them */
+static weights_t value_weights(const bb_list_t &bbs, const cfg_t &cfg, const dom_tree_t &dom){
+    std::vector<loop_t> loops;
+    loops_build(cfg, dom, loops);
+    std::map<koopa_raw_basic_block_t, int> depth;
+    for(auto &loop : loops){
+        for(auto bb : loop.blocks){
+            depth[bb] = std::max(depth[bb], loop.depth);
+        }
+    }
+
+    weights_t weights;
+    for(auto bb : bbs){
+        double weight = 1;
+        for(int k = 0; k < std::min(depth[bb], 3); ++k){
+            weight *= 10;
+        }
+        for(auto param : ir_values(bb->params)){
+            weights[param] += weight;
+        }
+        for(auto inst : ir_values(bb->insts)){
+            for(auto operand : ir_operands(inst)){
+                weights[operand] += weight;
+            }
+            weights[inst] += weight;
+        }
+    }
+    return weights;
+}
+
+/*
+    Colours the values of `r` (defined in it or live into its entry) from
+    `regs`, trying the hinted register first. Returns whether every value
+    got one.
+*/
+static bool color_region(region_t &r, const koopa_raw_function_t &func,
+        const std::vector<std::string> &regs, const reg_homes_t &hints,
+        weights_t &weights, reg_homes_t &homes){
+    /* in program order, so that the code does not depend on addresses */
+    std::vector<koopa_raw_value_t> values;
+    const auto &entry_live = r.live_in[r.bbs[0]];
+    for(auto param : ir_values(func->params)){
+        if(entry_live.count(param)){
+            values.push_back(param);
+        }
+    }
+    for(auto bb : ir_basic_blocks(func)){
+        bool is_in_region = r.in_region.count(bb);
+        for(auto param : ir_values(bb->params)){
+            if(is_in_region || entry_live.count(param)){
+                values.push_back(param);
+            }
+        }
+        for(auto inst : ir_values(bb->insts)){
+            if(r.candidates->count(inst) && (is_in_region || entry_live.count(inst))){
+                values.push_back(inst);
+            }
+        }
+    }
+    std::stable_sort(values.begin(), values.end(), [&](koopa_raw_value_t a, koopa_raw_value_t b){
+        if(hints.count(a) != hints.count(b)){
+            return hints.count(a) > hints.count(b);
+        }
+        return weights[a] > weights[b];
+    });
+
+    bool is_all = true;
+    for(auto value : values){
+        std::set<std::string> taken;
+        for(auto other : r.edges[value]){
+            auto it = homes.find(other);
+            if(it != homes.end()){
+                taken.insert(it->second);
+            }
+        }
+        if(r.across_call.count(value)){
+            taken.insert(arg_regs.begin(), arg_regs.end());
+        }
+        auto hint = hints.find(value);
+        if(hint != hints.end() && taken.count(hint->second) == 0){
+            homes[value] = hint->second;
+            continue;
+        }
+        bool is_colored = false;
+        for(auto &reg : regs){
+            if(taken.count(reg) == 0){
+                homes[value] = reg;
+                is_colored = true;
+                break;
+            }
+        }
+        is_all &= is_colored;
+    }
+    return is_all;
+}
+
+/* Needs sp or ra set up: calls, `alloc`s and params past a7 */
+static bool needs_frame(koopa_raw_value_t inst){
+    if(inst->kind.tag == KOOPA_RVT_CALL){
+        return true;
+    }
+    for(auto operand : ir_operands(inst)){
+        if(operand->kind.tag == KOOPA_RVT_ALLOC
+            || (operand->kind.tag == KOOPA_RVT_FUNC_ARG_REF && operand->kind.data.func_arg_ref.index >= 8)
+            || (is_inlined(operand) && needs_frame(operand))){
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Outside loops, and dominating every block reached from it. Without
+    params, as their args are copied before it is entered.
+*/
+static bool is_save_point(const cfg_t &cfg, const dom_tree_t &dom, koopa_raw_basic_block_t bb){
+    if(bb->params.len > 0){
+        return false;
+    }
+    std::set<koopa_raw_basic_block_t> visited;
+    bb_list_t stack = cfg.succs.at(bb);
+    while(!stack.empty()){
+        auto next = stack.back();
+        stack.pop_back();
+        if(next == bb || !dom_tree_dominates(dom, bb, next)){
+            return false;
+        }
+        if(visited.insert(next).second){
+            stack.insert(stack.end(), cfg.succs.at(next).begin(), cfg.succs.at(next).end());
+        }
+    }
+    return true;
+}
+
+/* Where the frame is set up, or nullptr if no block needs it */
+static koopa_raw_basic_block_t choose_save_bb(const bb_list_t &bbs, const cfg_t &cfg,
+        const dom_tree_t &dom){
+    bb_list_t needing;
+    for(auto bb : bbs){
+        for(auto inst : ir_values(bb->insts)){
+            if(!is_inlined(inst) && needs_frame(inst)){
+                needing.push_back(bb);
+                break;
+            }
+        }
+    }
+    if(needing.empty()){
+        return nullptr;
+    }
+    /* with unreachable blocks around, keep it simple */
+    if(cfg.rpo.size() != bbs.size()){
+        return bbs[0];
+    }
+
+    auto save = needing[0];
+    for(auto bb : needing){
+        while(!dom_tree_dominates(dom, save, bb)){
+            save = dom.idom.at(save);
+        }
+    }
+    while(save != bbs[0] && !is_save_point(cfg, dom, save)){
+        save = dom.idom.at(save);
+    }
+    return save;
+}
+
+void regalloc_run(const koopa_raw_function_t &func, const std::set<koopa_raw_value_t> &candidates,
+        reg_assignment_t &result){
+    auto bbs = ir_basic_blocks(func);
+    cfg_t cfg;
+    dom_tree_t dom;
+    cfg_build(func, cfg);
+    dom_tree_build(cfg, dom);
+    auto weights = value_weights(bbs, cfg, dom);
+
+    reg_homes_t param_hints;
+    auto params = ir_values(func->params);
+    for(size_t i = 0; i < params.size() && i < 8; ++i){
+        param_hints[params[i]] = arg_regs[i];
+    }
+
+    result = reg_assignment_t();
+    auto save = choose_save_bb(bbs, cfg, dom);
+    if(save == nullptr){
+        /* no frame at all if a0-a7 are enough */
+        region_t all;
+        all.bbs = bbs;
+        all.in_region.insert(bbs.begin(), bbs.end());
+        all.candidates = &candidates;
+        analyze_region(all);
+        if(color_region(all, func, arg_regs, param_hints, weights, result.early_homes)){
+            result.early_bbs = all.in_region;
+            return;
+        }
+        result.early_homes.clear();
+        save = bbs[0];
+    }
+
+    while(true){
+        /* the blocks from `save` on, then the ones before it */
+        region_t saved, early;
+        saved.candidates = early.candidates = &candidates;
+        bb_list_t stack = {save};
+        while(!stack.empty()){
+            auto bb = stack.back();
+            stack.pop_back();
+            if(saved.in_region.insert(bb).second && cfg.succs.count(bb)){
+                stack.insert(stack.end(), cfg.succs.at(bb).begin(), cfg.succs.at(bb).end());
+            }
+        }
+        if(save == bbs[0]){
+            saved.in_region.insert(bbs.begin(), bbs.end());
+        }
+        saved.bbs.push_back(save);
+        for(auto bb : bbs){
+            if(bb == save){
+                continue;
+            }
+            if(saved.in_region.count(bb)){
+                saved.bbs.push_back(bb);
+            }
+            else{
+                early.bbs.push_back(bb);
+                early.in_region.insert(bb);
+            }
+        }
+
+        analyze_region(saved);
+        std::vector<std::string> regs = arg_regs;
+        regs.insert(regs.end(), saved_regs.begin(), saved_regs.end());
+        result.homes.clear();
+        color_region(saved, func, regs, param_hints, weights, result.homes);
+
+        result.early_homes.clear();
+        if(!early.bbs.empty()){
+            early.exit_live = saved.live_in[save];
+            analyze_region(early);
+            if(!color_region(early, func, arg_regs, param_hints, weights, result.early_homes)){
+                /* values before `save` would need slots */
+                save = bbs[0];
+                continue;
+            }
+        }
+
+        result.save_bb = save;
+        result.early_bbs = early.in_region;
+        const auto &live_in = saved.live_in[save];
+        for(size_t i = 0; i < params.size() && i < 8; ++i){
+            if(live_in.count(params[i])){
+                result.early_homes[params[i]] = arg_regs[i];
+                result.save_live_in.push_back(params[i]);
+            }
+        }
+        for(auto bb : early.bbs){
+            for(auto param : ir_values(bb->params)){
+                if(live_in.count(param)){
+                    result.save_live_in.push_back(param);
+                }
+            }
+            for(auto inst : ir_values(bb->insts)){
+                if(live_in.count(inst)){
+                    result.save_live_in.push_back(inst);
+                }
+            }
+        }
+        return;
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "koopa.h"
+
+typedef std::map<koopa_raw_value_t, std::string> reg_homes_t;
+
+/*
+    Register homes by graph colouring, with the frame set up only where
+    it is needed (shrink-wrapping).
+
+    The save block dominates every block needing the frame: calls, uses
+    of `alloc`s and of params past a7. It is outside loops, has no block
+    params, and every block it reaches is one it dominates, so each path
+    sets the frame up at most once and returns through the epilogue
+    exactly when it did.
+    The blocks before it (`early_bbs`) only have a0-a7, no slots; the
+    values live into the save block are moved there from their early
+    homes. When no block needs a frame and a0-a7 are enough, there is no
+    save block at all; when they are not, the entry is the save block.
+
+    From the save block on, a value gets a0-a7 or s0-s11, only s0-s11 if
+    it is live across a call; the most used (weighted by loop depth) go
+    first. Values left without a colour stay in their stack slots.
+
+    Liveness looks through folded addresses and fused comparisons to
+    their operands, where they are emitted.
+*/
+typedef struct{
+    koopa_raw_basic_block_t save_bb;        /* nullptr: no frame */
+    std::set<koopa_raw_basic_block_t> early_bbs;
+    reg_homes_t homes;
+    reg_homes_t early_homes;
+    std::vector<koopa_raw_value_t> save_live_in;    /* moved from `early_homes` */
+} reg_assignment_t;
+
+void regalloc_run(const koopa_raw_function_t &func, const std::set<koopa_raw_value_t> &candidates,
+        reg_assignment_t &result);
+
+#endif /**< src/regalloc.h */
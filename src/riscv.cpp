@@ -1,9 +1,15 @@
 #include "riscv.h"
+#include "peephole.h"
 
 #include <iostream>
 #include <cassert>
+#include <map>
+#include <sstream>
+#include <vector>
 
-static int temp_label_id = 0;
+static std::stringstream function_code;
+static std::streambuf *stdout_buffer = nullptr;
+static int relax_label_id = 0;
 
 void gen_add(const std::string &rd, const std::string &rs1,
              const std::string &rs2){
@@ -17,6 +23,11 @@ void gen_sub(const std::string &rd, const std::string &rs1,
     std::cout << std::endl;
 }
 
+void gen_mv(const std::string &rd, const std::string &rs){
+    std::cout << "\tmv\t" << rd << ", " << rs;
+    std::cout << std::endl;
+}
+
 void gen_li(const std::string &rd, int32_t imm){
     std::cout << "\tli\t" << rd << ", " << imm;
     std::cout << std::endl;
@@ -88,16 +99,22 @@ void gen_la(const std::string &rd, const std::string &label){
     std::cout << std::endl;
 }
 
+/* Out of range targets are taken care of in `riscv_function_end` */
 void gen_bnez(const std::string &rs, const std::string &label){
-    // std::cout << "\tbnez\t" << rs << ", " << label;
-    // std::cout << std::endl;
-    std::string temp_label = "temp_label_" + std::to_string(temp_label_id++);
-    std::cout << "\tbnez\t" << rs << ", " << temp_label;
+    std::cout << "\tbnez\t" << rs << ", " << label;
+    std::cout << std::endl;
+}
+
+void gen_beqz(const std::string &rs, const std::string &label){
+    std::cout << "\tbeqz\t" << rs << ", " << label;
+    std::cout << std::endl;
+}
+
+/* beq, bne, blt, bge, ... */
+void gen_branch(const std::string &op, const std::string &rs1,
+                const std::string &rs2, const std::string &label){
+    std::cout << "\t" << op << "\t" << rs1 << ", " << rs2 << ", " << label;
     std::cout << std::endl;
-    std::cout << "\tj\t" << "after_" << temp_label << std::endl;
-    std::cout << temp_label << ":" << std::endl;
-    gen_j(label);
-    std::cout << "after_" << temp_label << ":" << std::endl;
 }
 
 void gen_j(const std::string &label){
@@ -116,6 +133,11 @@ void gen_call(const std::string &label){
     std::cout << std::endl;
 }
 
+void gen_tail(const std::string &label){
+    std::cout << "\ttail\t" << label;
+    std::cout << std::endl;
+}
+
 void gen_sll(const std::string &rd, const std::string &rs1,
              const std::string &rs2){
     std::cout << "\tsll\t" << rd << ", " << rs1 << ", " << rs2;
@@ -126,4 +148,353 @@ void gen_mul(const std::string &rd, const std::string &rs1,
              const std::string &rs2){
     std::cout << "\tmul\t" << rd << ", " << rs1 << ", " << rs2;
     std::cout << std::endl;
-}
\ No newline at end of file
+}
+
+void gen_mulh(const std::string &rd, const std::string &rs1,
+              const std::string &rs2){
+    std::cout << "\tmulh\t" << rd << ", " << rs1 << ", " << rs2;
+    std::cout << std::endl;
+}
+
+/* slli, srli, srai */
+void gen_shift_imm(const std::string &op, const std::string &rd,
+                   const std::string &rs1, int32_t shamt){
+    assert(shamt >= 0 && shamt < 32);
+    std::cout << "\t" << op << "\t" << rd << ", " << rs1 << ", " << shamt;
+    std::cout << std::endl;
+}
+
+void gen_andi(const std::string &rd, const std::string &rs1, int32_t imm){
+    if(imm > IMM12_MAX || imm < IMM12_MIN){
+        std::string rtemp = "t" + std::to_string(register_counter++);
+        gen_li(rtemp, imm);
+        std::cout << "\tand\t" << rd << ", " << rs1 << ", " << rtemp;
+        std::cout << std::endl;
+        --register_counter;
+    }
+    else{
+        std::cout << "\tandi\t" << rd << ", " << rs1 << ", " << imm;
+        std::cout << std::endl;
+    }
+}
+
+static int count_trailing_zeros(uint32_t x){
+    int n = 0;
+    while((x & 1) == 0){
+        x >>= 1;
+        ++n;
+    }
+    return n;
+}
+
+static bool is_power_of_two(uint32_t x){
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+/* |imm| without overflow: INT32_MIN gives 2^31 */
+static uint32_t abs_imm(int32_t imm){
+    return (imm < 0) ? -(uint32_t)imm : (uint32_t)imm;
+}
+
+/*
+    rd = rs * imm (mod 2^32). Powers of two are a shift; 2^a + 2^b and
+    2^a - 2^b two shifts and an add / sub; anything else a `mul`.
+*/
+void gen_mul_imm(const std::string &rd, const std::string &rs, int32_t imm){
+    uint32_t m = abs_imm(imm);
+    bool is_neg = imm < 0;
+    if(m == 0){
+        gen_li(rd, 0);
+        return;
+    }
+    if(is_power_of_two(m)){
+        gen_shift_imm("slli", rd, rs, count_trailing_zeros(m));
+        if(is_neg){
+            gen_sub(rd, "x0", rd);
+        }
+        return;
+    }
+
+    uint32_t low = m & -m;
+    int b = count_trailing_zeros(m);
+    std::string rtemp = "t" + std::to_string(register_counter++);
+    /* rs << b, with no shift for an odd imm */
+    std::string rlow = (b == 0) ? rs : rd;
+    if(is_power_of_two(m - low)){
+        /* rd = (rs << a) + (rs << b) */
+        gen_shift_imm("slli", rtemp, rs, count_trailing_zeros(m - low));
+        if(b > 0){
+            gen_shift_imm("slli", rd, rs, b);
+        }
+        gen_add(rd, rlow, rtemp);
+        if(is_neg){
+            gen_sub(rd, "x0", rd);
+        }
+    }
+    else if(is_power_of_two(m + low)){
+        /* rd = (rs << a) - (rs << b); swapped for a negative imm */
+        gen_shift_imm("slli", rtemp, rs, count_trailing_zeros(m + low));
+        if(b > 0){
+            gen_shift_imm("slli", rd, rs, b);
+        }
+        if(is_neg){
+            gen_sub(rd, rlow, rtemp);
+        }
+        else{
+            gen_sub(rd, rtemp, rlow);
+        }
+    }
+    else{
+        gen_li(rtemp, imm);
+        gen_mul(rd, rs, rtemp);
+    }
+    --register_counter;
+}
+
+/*
+    Magic number for signed division by `d` (|d| >= 2), from Hacker's
+    Delight 10-4: n / d == (mulh(n, magic) [+-n]) >> shift, plus one
+    when that is negative.
+*/
+static void signed_div_magic(int32_t d, int32_t &magic, int &shift){
+    const uint32_t two31 = 0x80000000u;
+    uint32_t ad = abs_imm(d);
+    uint32_t t = two31 + ((uint32_t)d >> 31);
+    uint32_t anc = t - 1 - t % ad;
+    int p = 31;
+    uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+    uint32_t delta;
+    do{
+        ++p;
+        q1 *= 2;
+        r1 *= 2;
+        if(r1 >= anc){
+            ++q1;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if(r2 >= ad){
+            ++q2;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    }while(q1 < delta || (q1 == delta && r1 == 0));
+    magic = (int32_t)(q2 + 1);
+    if(d < 0){
+        magic = -magic;
+    }
+    shift = p - 32;
+}
+
+/* rd = rs + (rs < 0 ? 2^k - 1 : 0), so that shifting right by k truncates */
+static void gen_round_bias(const std::string &rd, const std::string &rs, int k){
+    if(k == 1){
+        gen_shift_imm("srli", rd, rs, 31);
+    }
+    else{
+        gen_shift_imm("srai", rd, rs, 31);
+        gen_shift_imm("srli", rd, rd, 32 - k);
+    }
+    gen_add(rd, rs, rd);
+}
+
+/* rd = rs / imm, rounding toward zero like `div` (imm = 0 is left to it) */
+void gen_div_imm(const std::string &rd, const std::string &rs, int32_t imm){
+    uint32_t m = abs_imm(imm);
+    std::string rtemp = "t" + std::to_string(register_counter++);
+    if(m == 0){
+        gen_li(rtemp, imm);
+        std::cout << "\tdiv\t" << rd << ", " << rs << ", " << rtemp << std::endl;
+    }
+    else if(imm == 1){
+        gen_addi(rd, rs, 0);
+    }
+    else if(imm == -1){
+        gen_sub(rd, "x0", rs);
+    }
+    else if(is_power_of_two(m)){
+        int k = count_trailing_zeros(m);
+        gen_round_bias(rtemp, rs, k);
+        gen_shift_imm("srai", rd, rtemp, k);
+        if(imm < 0){
+            gen_sub(rd, "x0", rd);
+        }
+    }
+    else{
+        int32_t magic;
+        int shift;
+        signed_div_magic(imm, magic, shift);
+        std::string rq = "t" + std::to_string(register_counter++);
+        gen_li(rtemp, magic);
+        gen_mulh(rq, rs, rtemp);
+        if(imm > 0 && magic < 0){
+            gen_add(rq, rq, rs);
+        }
+        else if(imm < 0 && magic > 0){
+            gen_sub(rq, rq, rs);
+        }
+        if(shift > 0){
+            gen_shift_imm("srai", rq, rq, shift);
+        }
+        gen_shift_imm("srli", rtemp, rq, 31);
+        gen_add(rd, rq, rtemp);
+        --register_counter;
+    }
+    --register_counter;
+}
+
+/* rd = rs % imm, with the sign of rs like `rem` (imm = 0 is left to it) */
+void gen_rem_imm(const std::string &rd, const std::string &rs, int32_t imm){
+    uint32_t m = abs_imm(imm);
+    std::string rtemp = "t" + std::to_string(register_counter++);
+    if(m == 0){
+        gen_li(rtemp, imm);
+        std::cout << "\trem\t" << rd << ", " << rs << ", " << rtemp << std::endl;
+    }
+    else if(m == 1){
+        gen_li(rd, 0);
+    }
+    else if(is_power_of_two(m)){
+        /* rs - (rs rounded toward zero to a multiple of m) */
+        gen_round_bias(rtemp, rs, count_trailing_zeros(m));
+        gen_andi(rtemp, rtemp, (int32_t)-m);
+        gen_sub(rd, rs, rtemp);
+    }
+    else{
+        gen_div_imm(rtemp, rs, imm);
+        gen_mul_imm(rtemp, rtemp, imm);
+        gen_sub(rd, rs, rtemp);
+    }
+    --register_counter;
+}
+
+typedef struct{
+    std::string text;
+    std::string op;         /* empty for labels, blank lines, directives */
+    std::string operands;
+    std::string label;      /* defined here, or the target of a branch */
+    bool is_label;
+    bool is_long;
+} asm_line_t;
+
+/* Conditional branches and their inverse */
+static const std::map<std::string, std::string> branch_inverse = {
+    {"beqz", "bnez"}, {"bnez", "beqz"},
+    {"blez", "bgtz"}, {"bgtz", "blez"},
+    {"bltz", "bgez"}, {"bgez", "bltz"},
+    {"beq", "bne"}, {"bne", "beq"},
+    {"blt", "bge"}, {"bge", "blt"},
+    {"bgt", "ble"}, {"ble", "bgt"},
+    {"bltu", "bgeu"}, {"bgeu", "bltu"},
+    {"bgtu", "bleu"}, {"bleu", "bgtu"},
+};
+
+static asm_line_t parse_line(const std::string &text){
+    asm_line_t line = {text, "", "", "", false, false};
+    if(text.empty()){
+        return line;
+    }
+    if(text[0] != '\t'){
+        line.is_label = true;
+        line.label = text.substr(0, text.find(':'));
+        return line;
+    }
+    size_t end_op = text.find('\t', 1);
+    line.op = text.substr(1, end_op == std::string::npos ? std::string::npos : end_op - 1);
+    if(line.op[0] == '.'){
+        line.op = "";
+        return line;
+    }
+    if(end_op != std::string::npos){
+        line.operands = text.substr(end_op + 1);
+    }
+    if(branch_inverse.count(line.op)){
+        size_t comma = line.operands.rfind(", ");
+        line.label = line.operands.substr(comma + 2);
+        line.operands = line.operands.substr(0, comma);
+    }
+    return line;
+}
+
+/* Bytes taken once the assembler has expanded the pseudo instructions */
+static int32_t size_of_line(const asm_line_t &line){
+    if(line.op.empty()){
+        return 0;
+    }
+    if(line.op == "li"){
+        int32_t imm = std::stoi(line.operands.substr(line.operands.find(", ") + 2));
+        return (imm > IMM12_MAX || imm < IMM12_MIN) ? 8 : 4;
+    }
+    if(line.op == "la" || line.op == "call" || line.op == "tail"){
+        return 8;
+    }
+    return line.is_long ? 8 : 4;
+}
+
+void riscv_function_begin(){
+    function_code.str("");
+    function_code.clear();
+    stdout_buffer = std::cout.rdbuf(function_code.rdbuf());
+}
+
+/*
+    Branch relaxation: a conditional branch reaches +-4KiB only; farther
+    targets get the inverted branch over a `j`. Making a branch long only
+    ever moves code apart, so iterate until no more branches change.
+*/
+void riscv_function_end(){
+    std::cout.rdbuf(stdout_buffer);
+
+    std::vector<std::string> texts;
+    std::string text;
+    while(std::getline(function_code, text)){
+        texts.push_back(text);
+    }
+    peephole_run(texts);
+
+    std::vector<asm_line_t> lines;
+    for(auto &text : texts){
+        lines.push_back(parse_line(text));
+    }
+
+    bool changed = true;
+    while(changed){
+        changed = false;
+        std::vector<int32_t> addrs;
+        std::map<std::string, int32_t> labels;
+        int32_t addr = 0;
+        for(auto &line : lines){
+            addrs.push_back(addr);
+            if(line.is_label){
+                labels[line.label] = addr;
+            }
+            addr += size_of_line(line);
+        }
+        for(size_t i = 0; i < lines.size(); ++i){
+            auto &line = lines[i];
+            if(line.is_long || branch_inverse.count(line.op) == 0){
+                continue;
+            }
+            auto it = labels.find(line.label);
+            int32_t offset = (it == labels.end()) ? IMM32_MAX : it->second - addrs[i];
+            if(offset < -4096 || offset > 4094){
+                line.is_long = true;
+                changed = true;
+            }
+        }
+    }
+
+    for(auto &line : lines){
+        if(!line.is_long){
+            std::cout << line.text << std::endl;
+            continue;
+        }
+        std::string skip = "relax_" + std::to_string(relax_label_id++);
+        std::cout << "\t" << branch_inverse.at(line.op) << "\t" << line.operands
+                  << ", " << skip << std::endl;
+        gen_j(line.label);
+        std::cout << skip << ":" << std::endl;
+    }
+}
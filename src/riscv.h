@@ -19,6 +19,12 @@ void gen_sll(const std::string &rd, const std::string &rs1,
              const std::string &rs2);
 void gen_mul(const std::string &rd, const std::string &rs1,
              const std::string &rs2);
+void gen_mulh(const std::string &rd, const std::string &rs1,
+              const std::string &rs2);
+void gen_shift_imm(const std::string &op, const std::string &rd,
+                   const std::string &rs1, int32_t shamt);
+void gen_andi(const std::string &rd, const std::string &rs1, int32_t imm);
+void gen_mv(const std::string &rd, const std::string &rs);
 void gen_li(const std::string &rd, int32_t imm);
 void gen_addi(const std::string &rd, const std::string &rs1, int32_t imm);
 void gen_sw(const std::string &rs2, int32_t imm, const std::string &rs1);
@@ -26,7 +32,27 @@ void gen_lw(const std::string &rs, int32_t imm, const std::string &rd);
 void gen_ret();
 void gen_la(const std::string &rd, const std::string &label);
 void gen_bnez(const std::string &rs, const std::string &label);
+void gen_beqz(const std::string &rs, const std::string &label);
+void gen_branch(const std::string &op, const std::string &rs1,
+                const std::string &rs2, const std::string &label);
 void gen_j(const std::string &label);
 void gen_call(const std::string &label);
+void gen_tail(const std::string &label);
+
+/*
+    Multiplication, division and remainder by a constant, with shifts or
+    a `mulh` by a magic number where that beats `mul` / `div` / `rem`.
+    Results match the RISCV instructions for every rs.
+*/
+void gen_mul_imm(const std::string &rd, const std::string &rs, int32_t imm);
+void gen_div_imm(const std::string &rd, const std::string &rs, int32_t imm);
+void gen_rem_imm(const std::string &rd, const std::string &rs, int32_t imm);
+
+/*
+    The code of a function is kept until its end, where the conditional
+    branches are relaxed against the final layout
+*/
+void riscv_function_begin();
+void riscv_function_end();
 
 #endif /**< src/riscv.h */
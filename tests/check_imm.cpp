@@ -0,0 +1,224 @@
+#include "riscv.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <vector>
+
+/*
+    Checks gen_mul_imm / gen_div_imm / gen_rem_imm against the semantics
+    of `mul` / `div` / `rem`.
+
+    The code emitted for each constant is parsed back and interpreted on a
+    register file, once with rd != rs (rs must survive) and once with
+    rd == rs. Constants: every one in [-300, 300], +-2^k, 2^k +- 1, the
+    int32 extremes and random ones; operands: the extremes, a dense range
+    around zero, multiples of the constant +- 1 and random values.
+
+    Build and run with `make check-imm`.
+*/
+
+int register_counter = 0;
+
+typedef struct{
+    std::string op;
+    std::vector<std::string> args;
+} inst_t;
+
+typedef std::vector<inst_t> code_t;
+
+typedef enum{
+    OP_MUL,
+    OP_DIV,
+    OP_REM,
+} imm_op_t;
+
+static const char *op_names[] = {"mul", "div", "rem"};
+
+static code_t parse_code(const std::string &text){
+    code_t code;
+    std::istringstream in(text);
+    std::string line;
+    while(std::getline(in, line)){
+        if(line.empty()){
+            continue;
+        }
+        inst_t inst;
+        size_t end_op = line.find('\t', 1);
+        inst.op = line.substr(1, end_op - 1);
+        std::string rest = line.substr(end_op + 1);
+        size_t comma;
+        while((comma = rest.find(", ")) != std::string::npos){
+            inst.args.push_back(rest.substr(0, comma));
+            rest = rest.substr(comma + 2);
+        }
+        inst.args.push_back(rest);
+        code.push_back(inst);
+    }
+    return code;
+}
+
+static code_t emit(imm_op_t op, const std::string &rd, const std::string &rs, int32_t imm){
+    std::stringstream text;
+    auto old = std::cout.rdbuf(text.rdbuf());
+    register_counter = 1;
+    if(op == OP_MUL){
+        gen_mul_imm(rd, rs, imm);
+    }
+    else if(op == OP_DIV){
+        gen_div_imm(rd, rs, imm);
+    }
+    else{
+        gen_rem_imm(rd, rs, imm);
+    }
+    std::cout.rdbuf(old);
+    if(register_counter != 1){
+        printf("%s %d: temporary registers not released\n", op_names[op], imm);
+        exit(1);
+    }
+    return parse_code(text.str());
+}
+
+static int32_t riscv_div(int32_t a, int32_t b){
+    if(b == 0){
+        return -1;
+    }
+    return (a == INT32_MIN && b == -1) ? a : a / b;
+}
+
+static int32_t riscv_rem(int32_t a, int32_t b){
+    if(b == 0){
+        return a;
+    }
+    return (a == INT32_MIN && b == -1) ? 0 : a % b;
+}
+
+static int32_t expected(imm_op_t op, int32_t x, int32_t imm){
+    if(op == OP_MUL){
+        return (int32_t)((uint32_t)x * (uint32_t)imm);
+    }
+    return (op == OP_DIV) ? riscv_div(x, imm) : riscv_rem(x, imm);
+}
+
+/* Runs `code` on `regs`; false on an instruction it does not know */
+static bool run(const code_t &code, std::map<std::string, uint32_t> &regs){
+    auto reg = [&](const std::string &name) -> uint32_t {
+        return (name == "x0") ? 0 : regs[name];
+    };
+    for(auto &inst : code){
+        const std::string &op = inst.op;
+        uint32_t result;
+        if(op == "li"){
+            result = (uint32_t)std::stol(inst.args[1]);
+        }
+        else{
+            bool is_imm = (op == "addi" || op == "andi" || op == "slli" || op == "srli" || op == "srai");
+            uint32_t a = reg(inst.args[1]);
+            uint32_t b = is_imm ? (uint32_t)std::stol(inst.args[2]) : reg(inst.args[2]);
+            if(op == "add" || op == "addi"){
+                result = a + b;
+            }
+            else if(op == "sub"){
+                result = a - b;
+            }
+            else if(op == "and" || op == "andi"){
+                result = a & b;
+            }
+            else if(op == "mul"){
+                result = a * b;
+            }
+            else if(op == "mulh"){
+                result = (uint32_t)(((int64_t)(int32_t)a * (int32_t)b) >> 32);
+            }
+            else if(op == "div"){
+                result = (uint32_t)riscv_div((int32_t)a, (int32_t)b);
+            }
+            else if(op == "rem"){
+                result = (uint32_t)riscv_rem((int32_t)a, (int32_t)b);
+            }
+            else if(op == "slli"){
+                result = a << b;
+            }
+            else if(op == "srli"){
+                result = a >> b;
+            }
+            else if(op == "srai"){
+                result = (uint32_t)((int32_t)a >> b);
+            }
+            else{
+                printf("unknown instruction `%s`\n", op.c_str());
+                return false;
+            }
+        }
+        if(inst.args[0] != "x0"){
+            regs[inst.args[0]] = result;
+        }
+    }
+    return true;
+}
+
+static std::vector<int32_t> constants(std::mt19937 &rng){
+    std::vector<int32_t> imms;
+    for(int32_t imm = -300; imm <= 300; ++imm){
+        imms.push_back(imm);
+    }
+    for(int k = 0; k < 31; ++k){
+        int32_t power = (int32_t)(1u << k);
+        imms.insert(imms.end(), {power, -power, power + 1, power - 1, -power - 1});
+    }
+    imms.insert(imms.end(), {INT32_MIN, INT32_MIN + 1, INT32_MAX});
+    for(int i = 0; i < 2000; ++i){
+        imms.push_back((int32_t)rng());
+    }
+    return imms;
+}
+
+static std::vector<int32_t> operands(std::mt19937 &rng, int32_t imm){
+    std::vector<int32_t> xs = {INT32_MIN, INT32_MIN + 1, INT32_MAX - 1, INT32_MAX};
+    for(int32_t x = -1000; x <= 1000; ++x){
+        xs.push_back(x);
+    }
+    for(int i = 0; i < 40; ++i){
+        uint32_t multiple = (uint32_t)imm * (rng() % 100000);
+        xs.insert(xs.end(), {(int32_t)multiple, (int32_t)(multiple + 1), (int32_t)(multiple - 1)});
+    }
+    for(int i = 0; i < 1000; ++i){
+        xs.push_back((int32_t)rng());
+    }
+    return xs;
+}
+
+int main(){
+    std::mt19937 rng(1);
+    long checks = 0;
+    for(auto imm : constants(rng)){
+        auto xs = operands(rng, imm);
+        for(int op = OP_MUL; op <= OP_REM; ++op){
+            auto apart = emit((imm_op_t)op, "a0", "a1", imm);
+            auto same = emit((imm_op_t)op, "a0", "a0", imm);
+            for(auto x : xs){
+                int32_t want = expected((imm_op_t)op, x, imm);
+                std::map<std::string, uint32_t> regs = {{"a1", (uint32_t)x}};
+                if(!run(apart, regs)){
+                    return 1;
+                }
+                bool ok = (int32_t)regs["a0"] == want && (int32_t)regs["a1"] == x;
+                regs = {{"a0", (uint32_t)x}};
+                if(!run(same, regs)){
+                    return 1;
+                }
+                ok = ok && (int32_t)regs["a0"] == want;
+                if(!ok){
+                    printf("%s %d by %d: wrong result\n", op_names[op], x, imm);
+                    return 1;
+                }
+                checks += 2;
+            }
+        }
+    }
+    printf("ok, %ld checks\n", checks);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#!/bin/bash
+# Compiles every tests/regress/<name>.c with -riscv and with -perf, runs it on
+# <name>.in (if any) and compares its output, followed by the exit code, with
+# <name>.out.
+# With RISCV_RUN set, `$RISCV_RUN file.S` runs the assembly (a simulator);
+# otherwise it is linked with libsysy and run by qemu, as in the course image.
+set -u
+DIR=$(cd "$(dirname "$0")" && pwd)
+COMPILER=${COMPILER:-$DIR/../build/compiler}
+WORK=${WORK:-$DIR/../build/regress}
+mkdir -p "$WORK"
+
+fail=0
+for src in "$DIR"/regress/*.c; do
+    name=$(basename "$src" .c)
+    input=/dev/null
+    [ -f "$DIR/regress/$name.in" ] && input="$DIR/regress/$name.in"
+    for mode in -riscv -perf; do
+        asm="$WORK/$name$mode.S"
+        out="$WORK/$name$mode.out"
+        if ! "$COMPILER" $mode "$src" -o "$asm" 2>/dev/null; then
+            echo "FAIL $name $mode: does not compile"
+            fail=1
+            continue
+        fi
+        if [ -n "${RISCV_RUN:-}" ]; then
+            $RISCV_RUN "$asm" < "$input" > "$out" 2>/dev/null
+        else
+            clang "$asm" -c -o "$WORK/$name.o" -target riscv32-unknown-linux-elf -march=rv32im -mabi=ilp32 \
+                && ld.lld "$WORK/$name.o" -L"$CDE_LIBRARY_PATH/riscv32" -lsysy -o "$WORK/$name" \
+                && qemu-riscv32-static "$WORK/$name" < "$input" > "$out"
+        fi
+        status=$?
+        [ -n "$(tail -c 1 "$out")" ] && echo >> "$out"
+        echo $status >> "$out"
+        if cmp -s "$out" "$DIR/regress/$name.out"; then
+            echo "ok   $name $mode"
+        else
+            echo "FAIL $name $mode"
+            fail=1
+        fi
+    done
+done
+exit $fail
@@ -0,0 +1,37 @@
+// A store through `a[i]` in a loop is not overwritten by the `a[i]` after it:
+// the same address expression names another element on every trip.
+int a[10];
+int ga[8];
+
+int main(){
+    int i = 0;
+    int n = getint();
+    while(i < n){
+        a[i] = 5;
+        i = i + 1;
+    }
+    a[i] = 7;
+    i = 0;
+    while(i < 10){
+        putint(a[i]);
+        i = i + 1;
+    }
+    putch(10);
+
+    int k = 0;
+    while(k < 3){
+        ga[k] = k;
+        ga[k] = ga[k] + 1;
+        k = k + 1;
+    }
+    ga[k] = 50;
+    int s = 0;
+    i = 0;
+    while(i < 8){
+        s = s + ga[i];
+        i = i + 1;
+    }
+    putint(s);
+    putch(10);
+    return 0;
+}
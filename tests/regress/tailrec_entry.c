@@ -0,0 +1,18 @@
+// A self tail call in the entry block of a function main never calls.
+void g(int n){
+    putint(n);
+    g(n - 1);
+}
+
+int f(int n, int acc){
+    if(n == 0) return acc;
+    return f(n - 1, acc + n);
+}
+
+int main(){
+    putint(3);
+    putch(10);
+    putint(f(10, 0));
+    putch(10);
+    return 0;
+}